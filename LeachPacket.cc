@@ -1,24 +1,66 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
 #include "LeachPacket.h"
 #include "ns3/address-utils.h"
+#include "ns3/assert.h"
 #include "ns3/packet.h"
 #include "ns3/vector.h"
 
 namespace ns3 {
 namespace leach {
 
+// Position in quarter meters
+static const double POSITION_SCALE = 4.0;
+
+static int16_t
+ToFixed (double value, double scale)
+{
+    double fixed = std::floor (value*scale + 0.5);
+    if (fixed > std::numeric_limits<int16_t>::max ())
+    {
+        return std::numeric_limits<int16_t>::max ();
+    }
+    if (fixed < std::numeric_limits<int16_t>::min ())
+    {
+        return std::numeric_limits<int16_t>::min ();
+    }
+    return fixed;
+}
+
+static double
+FromFixed (uint16_t value, double scale)
+{
+    return static_cast<int16_t> (value)/scale;
+}
+
+LeachMessageType
+PeekMessageType (Ptr<const Packet> p)
+{
+    uint8_t type = LEACH_INVALID;
+    p->CopyData (&type, 1);
+    switch (type)
+    {
+        case LEACH_ADVERTISEMENT:
+        case LEACH_JOIN:
+        case LEACH_DATA:
+            return static_cast<LeachMessageType> (type);
+        default:
+            return LEACH_INVALID;
+    }
+}
+
 NS_OBJECT_ENSURE_REGISTERED(LeachHeader);
 
-#if 1
-//LeachHeader::LeachHeader (BooleanValue PIR, Vector position, Vector acceleration, Ipv4Address address, Time m)
-LeachHeader::LeachHeader (BooleanValue PIR, Vector position, Vector acceleration, Ipv4Address address, Time m) :
-    m_PIR (PIR),
-    m_position (position),
-    m_acceleration (acceleration),
-    m_address (address),
-    m_deadline (m)
+LeachHeader::LeachHeader (Ipv4Address source, uint16_t sequence, Time deadline) :
+    m_valid (true),
+    m_source (source),
+    m_sequence (sequence),
+    m_deadline (deadline)
 {
 }
-#endif
 
 LeachHeader::~LeachHeader ()
 {
@@ -43,18 +85,24 @@ LeachHeader::GetInstanceTypeId () const
 uint32_t
 LeachHeader::GetSerializedSize () const
 {
-    return sizeof(m_PIR)+sizeof(m_position)+sizeof(m_acceleration)+sizeof(m_address)+sizeof(m_deadline);
+    return 11;
 }
 
 void 
 LeachHeader::Serialize (Buffer::Iterator i) const
 {
-    i.Write ((const uint8_t*)&m_PIR,            sizeof(m_PIR));
-    i.Write ((const uint8_t*)&m_acceleration,   sizeof(m_acceleration));
-    i.Write ((const uint8_t*)&m_position,       sizeof(m_position));
-    i.Write ((const uint8_t*)&m_address,        sizeof(m_address));
-    i.Write ((const uint8_t*)&m_address+4,      sizeof(m_address));
-    i.Write ((const uint8_t*)&m_deadline,       sizeof(m_deadline));
+    // Deadline is rounded up to a whole ms, a record is never due earlier than asked
+    int64_t deadline = m_deadline.GetMilliSeconds ();
+    if (MilliSeconds (deadline) < m_deadline)
+    {
+        deadline++;
+    }
+    deadline = std::max<int64_t> (0, std::min<int64_t> (deadline, std::numeric_limits<uint32_t>::max ()));
+
+    i.WriteU8 (LEACH_DATA);
+    i.WriteHtonU32 (m_source.Get ());
+    i.WriteHtonU16 (m_sequence);
+    i.WriteHtonU32 (deadline);
 }
 
 uint32_t
@@ -62,12 +110,15 @@ LeachHeader::Deserialize (Buffer::Iterator start)
 {
     Buffer::Iterator i = start;
 
-    i.Read ((uint8_t*)&m_PIR,           sizeof(m_PIR));
-    i.Read ((uint8_t*)&m_position,      sizeof(m_position));
-    i.Read ((uint8_t*)&m_acceleration,  sizeof(m_acceleration));
-    i.Read ((uint8_t*)&m_address,       sizeof(m_address));
-    i.ReadU32();
-    i.Read ((uint8_t*)&m_deadline,      sizeof(m_deadline));
+    m_valid = false;
+    if (i.GetRemainingSize () < GetSerializedSize () || i.ReadU8 () != LEACH_DATA)
+    {
+        return 0;
+    }
+    m_source.Set (i.ReadNtohU32 ());
+    m_sequence = i.ReadNtohU16 ();
+    m_deadline = MilliSeconds (i.ReadNtohU32 ());
+    m_valid = true;
 
     uint32_t dist = i.GetDistanceFrom(start);
     NS_ASSERT (dist == GetSerializedSize());
@@ -77,14 +128,497 @@ LeachHeader::Deserialize (Buffer::Iterator start)
 void 
 LeachHeader::Print(std::ostream &os) const
 {
-  os << " PIR: "            << m_PIR
-     << " Position: "       << m_position 
-     << " Acceleration: "   << m_acceleration 
-     << ", IP: "            << m_address 
+  os << " Source: "         << m_source
+     << ", Sequence: "      << m_sequence
      << ", Deadline:"       << m_deadline 
      << "\n";
 }
 
+NS_OBJECT_ENSURE_REGISTERED(LeachAdvertisementHeader);
+
+LeachAdvertisementHeader::LeachAdvertisementHeader (Vector position, double energy, uint32_t round) :
+    m_valid (true),
+    m_position (position),
+    m_energy (energy),
+    m_round (round)
+{
+}
+
+LeachAdvertisementHeader::~LeachAdvertisementHeader ()
+{
+}
+
+TypeId 
+LeachAdvertisementHeader::GetTypeId (void)
+{
+    static TypeId tid = TypeId ("ns3::leach::LeachAdvertisementHeader")
+        .SetParent<Header> ()
+        .SetGroupName("Leach")
+        .AddConstructor<LeachAdvertisementHeader>();
+    return tid;
+}
+
+TypeId 
+LeachAdvertisementHeader::GetInstanceTypeId () const
+{
+    return GetTypeId ();
+}
+
+uint32_t
+LeachAdvertisementHeader::GetSerializedSize () const
+{
+    return 11;
+}
+
+void 
+LeachAdvertisementHeader::Serialize (Buffer::Iterator i) const
+{
+    double energy = std::max (0.0, std::min (m_energy, 1.0));
+
+    i.WriteU8 (LEACH_ADVERTISEMENT);
+    i.WriteHtonU16 (ToFixed (m_position.x, POSITION_SCALE));
+    i.WriteHtonU16 (ToFixed (m_position.y, POSITION_SCALE));
+    i.WriteHtonU16 (std::floor (energy*std::numeric_limits<uint16_t>::max () + 0.5));
+    i.WriteHtonU32 (m_round);
+}
+
+uint32_t
+LeachAdvertisementHeader::Deserialize (Buffer::Iterator start)
+{
+    Buffer::Iterator i = start;
+
+    m_valid = false;
+    if (i.GetRemainingSize () < GetSerializedSize () || i.ReadU8 () != LEACH_ADVERTISEMENT)
+    {
+        return 0;
+    }
+    m_position.x = FromFixed (i.ReadNtohU16 (), POSITION_SCALE);
+    m_position.y = FromFixed (i.ReadNtohU16 (), POSITION_SCALE);
+    m_position.z = 0;
+    m_energy = i.ReadNtohU16 ()/(double) std::numeric_limits<uint16_t>::max ();
+    m_round = i.ReadNtohU32 ();
+    m_valid = true;
+
+    uint32_t dist = i.GetDistanceFrom(start);
+    NS_ASSERT (dist == GetSerializedSize());
+    return dist;
+}
+
+void 
+LeachAdvertisementHeader::Print(std::ostream &os) const
+{
+  os << " Position: "  << m_position
+     << ", Energy: "   << m_energy
+     << ", Round: "    << m_round
+     << "\n";
+}
+
+NS_OBJECT_ENSURE_REGISTERED(LeachJoinHeader);
+
+LeachJoinHeader::LeachJoinHeader (Ipv4Address member) :
+    m_valid (true),
+    m_member (member)
+{
+}
+
+LeachJoinHeader::~LeachJoinHeader ()
+{
+}
+
+TypeId 
+LeachJoinHeader::GetTypeId (void)
+{
+    static TypeId tid = TypeId ("ns3::leach::LeachJoinHeader")
+        .SetParent<Header> ()
+        .SetGroupName("Leach")
+        .AddConstructor<LeachJoinHeader>();
+    return tid;
+}
+
+TypeId 
+LeachJoinHeader::GetInstanceTypeId () const
+{
+    return GetTypeId ();
+}
+
+uint32_t
+LeachJoinHeader::GetSerializedSize () const
+{
+    return 5;
+}
+
+void 
+LeachJoinHeader::Serialize (Buffer::Iterator i) const
+{
+    i.WriteU8 (LEACH_JOIN);
+    i.WriteHtonU32 (m_member.Get ());
+}
+
+uint32_t
+LeachJoinHeader::Deserialize (Buffer::Iterator start)
+{
+    Buffer::Iterator i = start;
+
+    m_valid = false;
+    if (i.GetRemainingSize () < GetSerializedSize () || i.ReadU8 () != LEACH_JOIN)
+    {
+        return 0;
+    }
+    m_member.Set (i.ReadNtohU32 ());
+    m_valid = true;
+
+    uint32_t dist = i.GetDistanceFrom(start);
+    NS_ASSERT (dist == GetSerializedSize());
+    return dist;
+}
+
+void 
+LeachJoinHeader::Print(std::ostream &os) const
+{
+  os << " Member: " << m_member
+     << "\n";
+}
+
+NS_OBJECT_ENSURE_REGISTERED(LeachReadingHeader);
+
+LeachReadingHeader::LeachReadingHeader (double value) :
+    m_value (value),
+    m_function (0),
+    m_sources (1),
+    m_count (1)
+{
+}
+
+LeachReadingHeader::~LeachReadingHeader ()
+{
+}
+
+TypeId 
+LeachReadingHeader::GetTypeId (void)
+{
+    static TypeId tid = TypeId ("ns3::leach::LeachReadingHeader")
+        .SetParent<Header> ()
+        .SetGroupName("Leach")
+        .AddConstructor<LeachReadingHeader>();
+    return tid;
+}
+
+TypeId 
+LeachReadingHeader::GetInstanceTypeId () const
+{
+    return GetTypeId ();
+}
+
+uint32_t
+LeachReadingHeader::GetSerializedSize () const
+{
+    return 13;
+}
+
+void 
+LeachReadingHeader::Serialize (Buffer::Iterator i) const
+{
+    uint64_t bits;
+    std::memcpy (&bits, &m_value, sizeof(bits));
+    i.WriteHtonU64 (bits);
+    i.WriteU8 (m_function);
+    i.WriteHtonU16 (m_sources);
+    i.WriteHtonU16 (m_count);
+}
+
+uint32_t
+LeachReadingHeader::Deserialize (Buffer::Iterator start)
+{
+    Buffer::Iterator i = start;
+
+    uint64_t bits = i.ReadNtohU64 ();
+    std::memcpy (&m_value, &bits, sizeof(m_value));
+    m_function = i.ReadU8 ();
+    m_sources = i.ReadNtohU16 ();
+    m_count = i.ReadNtohU16 ();
+
+    uint32_t dist = i.GetDistanceFrom(start);
+    NS_ASSERT (dist == GetSerializedSize());
+    return dist;
+}
+
+void 
+LeachReadingHeader::Print(std::ostream &os) const
+{
+  os << " Reading: "  << m_value
+     << ", Function: " << (uint16_t) m_function
+     << ", Sources: "  << m_sources
+     << ", Count: "    << m_count
+     << "\n";
+}
+
+NS_OBJECT_ENSURE_REGISTERED(LeachAggregateHeader);
+
+const uint8_t LeachAggregateHeader::MARKER = 0xa7;
+
+LeachAggregateHeader::LeachAggregateHeader () :
+    m_valid (true),
+    m_bytes (0)
+{
+}
+
+LeachAggregateHeader::~LeachAggregateHeader ()
+{
+}
+
+TypeId 
+LeachAggregateHeader::GetTypeId (void)
+{
+    static TypeId tid = TypeId ("ns3::leach::LeachAggregateHeader")
+        .SetParent<Header> ()
+        .SetGroupName("Leach")
+        .AddConstructor<LeachAggregateHeader>();
+    return tid;
+}
+
+TypeId 
+LeachAggregateHeader::GetInstanceTypeId () const
+{
+    return GetTypeId ();
+}
+
+uint32_t
+LeachAggregateHeader::GetSerializedSize () const
+{
+    return 3 + 2*m_lengths.size ();
+}
+
+void 
+LeachAggregateHeader::Serialize (Buffer::Iterator i) const
+{
+    i.WriteU8 (MARKER);
+    i.WriteHtonU16 (m_lengths.size ());
+    for (std::vector<uint16_t>::const_iterator j = m_lengths.begin (); j != m_lengths.end (); ++j)
+    {
+        i.WriteHtonU16 (*j);
+    }
+}
+
+uint32_t
+LeachAggregateHeader::Deserialize (Buffer::Iterator start)
+{
+    Buffer::Iterator i = start;
+
+    Clear ();
+    m_valid = false;
+    if (i.GetRemainingSize () < 3 || i.ReadU8 () != MARKER)
+    {
+        return 0;
+    }
+    uint16_t count = i.ReadNtohU16 ();
+    // Length table is read without further checks
+    if (i.GetRemainingSize () < 2u*count)
+    {
+        return 0;
+    }
+    m_lengths.resize (count);
+    for (uint16_t j = 0; j < count; ++j)
+    {
+        m_lengths[j] = i.ReadNtohU16 ();
+        m_bytes += m_lengths[j];
+    }
+    m_valid = true;
+
+    uint32_t dist = i.GetDistanceFrom(start);
+    NS_ASSERT (dist == GetSerializedSize());
+    return dist;
+}
+
+void 
+LeachAggregateHeader::Print(std::ostream &os) const
+{
+  os << " Records: " << m_lengths.size ()
+     << ", Bytes: "  << m_bytes
+     << "\n";
+}
+
+void
+LeachAggregateHeader::AddRecord (uint32_t length)
+{
+    // Lengths and record count are written in 16 bits, larger values would break the framing
+    NS_ASSERT_MSG (length <= std::numeric_limits<uint16_t>::max (), "Record of " << length << " bytes does not fit an aggregate");
+    NS_ASSERT_MSG (m_lengths.size () < std::numeric_limits<uint16_t>::max (), "Aggregate is full");
+    m_lengths.push_back (length);
+    m_bytes += length;
+}
+
+void
+LeachAggregateHeader::Clear ()
+{
+    m_lengths.clear ();
+    m_bytes = 0;
+    m_valid = true;
+}
+
+bool
+LeachAggregateHeader::IsAggregate (Ptr<const Packet> p)
+{
+    LeachAggregateHeader aggregate;
+    p->PeekHeader (aggregate);
+    return aggregate.IsValid () && aggregate.GetSerializedSize () + aggregate.GetRecordBytes () == p->GetSize ();
+}
+
+NS_OBJECT_ENSURE_REGISTERED(LeachDataTag);
+
+LeachDataTag::LeachDataTag (Ipv4Address origin, uint32_t sequence, Time deadline, Time generated) :
+    m_origin (origin),
+    m_sequence (sequence),
+    m_deadline (deadline),
+    m_generated (generated)
+{
+}
+
+TypeId
+LeachDataTag::GetTypeId (void)
+{
+    static TypeId tid = TypeId ("ns3::leach::LeachDataTag")
+        .SetParent<Tag> ()
+        .SetGroupName("Leach")
+        .AddConstructor<LeachDataTag>();
+    return tid;
+}
+
+TypeId
+LeachDataTag::GetInstanceTypeId () const
+{
+    return GetTypeId ();
+}
+
+uint32_t
+LeachDataTag::GetSerializedSize () const
+{
+    return 24;
+}
+
+void
+LeachDataTag::Serialize (TagBuffer i) const
+{
+    i.WriteU32 (m_origin.Get ());
+    i.WriteU32 (m_sequence);
+    i.WriteU64 (m_deadline.GetTimeStep ());
+    i.WriteU64 (m_generated.GetTimeStep ());
+}
+
+void
+LeachDataTag::Deserialize (TagBuffer i)
+{
+    m_origin.Set (i.ReadU32 ());
+    m_sequence = i.ReadU32 ();
+    m_deadline = TimeStep (i.ReadU64 ());
+    m_generated = TimeStep (i.ReadU64 ());
+}
+
+void
+LeachDataTag::Print(std::ostream &os) const
+{
+  os << " Origin: "      << m_origin
+     << ", Sequence: "   << m_sequence
+     << ", Deadline: "   << m_deadline
+     << ", Generated: "  << m_generated;
+}
+
+void
+LeachDataTag::Merge (LeachDataTag const &other)
+{
+    m_deadline = std::min (m_deadline, other.m_deadline);
+    m_generated = std::min (m_generated, other.m_generated);
+}
+
+LeachRecordReader::LeachRecordReader ()
+    : m_skip (0),
+      m_index (0),
+      m_size (0),
+      m_offset (0),
+      m_recordOffset (0),
+      m_recordSize (0),
+      m_recordHeaderSize (0)
+{
+}
+
+LeachRecordReader::LeachRecordReader (Ptr<const Packet> p)
+    : m_skip (0),
+      m_index (0),
+      m_size (0),
+      m_offset (0),
+      m_recordOffset (0),
+      m_recordSize (0),
+      m_recordHeaderSize (0)
+{
+    Reset (p);
+}
+
+void
+LeachRecordReader::Reset (Ptr<const Packet> p)
+{
+    m_size = p->GetSize ();
+    m_index = 0;
+    m_offset = 0;
+    m_recordOffset = 0;
+    m_recordSize = 0;
+    m_recordHeaderSize = 0;
+    m_skip = 0;
+    // Copy shares the bytes of p, removing read records from its front moves no bytes
+    m_rest = p->Copy ();
+    m_offset = m_rest->PeekHeader (m_aggregate);
+    m_rest->RemoveAtStart (m_offset);
+}
+
+bool
+LeachRecordReader::Next (LeachHeader &header)
+{
+    if (!m_aggregate.IsValid () || m_index >= m_aggregate.GetRecordCount ())
+    {
+        return false;
+    }
+    uint32_t length = m_aggregate.GetRecordLength (m_index);
+    if (m_size - m_offset < length || length < header.GetSerializedSize ())
+    {
+        return false;
+    }
+    // Rest of the previous record is not read any more
+    m_rest->RemoveAtStart (m_skip);
+    m_skip = 0;
+    m_recordHeaderSize = m_rest->PeekHeader (header);
+    if (!header.IsValid () || m_recordHeaderSize > length)
+    {
+        return false;
+    }
+    m_rest->RemoveAtStart (m_recordHeaderSize);
+    m_skip = length - m_recordHeaderSize;
+    m_recordOffset = m_offset;
+    m_recordSize = length;
+    m_offset += length;
+    m_index++;
+    return true;
+}
+
+bool
+LeachRecordReader::GetReading (LeachReadingHeader &reading) const
+{
+    if (m_recordSize < m_recordHeaderSize + reading.GetSerializedSize ())
+    {
+        return false;
+    }
+    m_rest->PeekHeader (reading);
+    return true;
+}
+
+LeachAggregateHeader
+LeachRecordReader::GetRemainingHeader () const
+{
+    LeachAggregateHeader remaining;
+    for (uint16_t i = m_index; i < m_aggregate.GetRecordCount (); ++i)
+    {
+        remaining.AddRecord (m_aggregate.GetRecordLength (i));
+    }
+    return remaining;
+}
+
 }  /* namespace leach */
 }  /* namespace ns3   */
 
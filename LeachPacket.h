@@ -2,66 +2,152 @@
 #define LEACH_PACKET_H
 
 #include <iostream>
+#include <vector>
+#include "ns3/buffer.h"
 #include "ns3/header.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/nstime.h"
+#include "ns3/packet.h"
+#include "ns3/ptr.h"
+#include "ns3/tag.h"
 #include "ns3/vector.h"
-#include "ns3/boolean.h"
 
 namespace ns3 {
 namespace leach {
+/// Type of a LEACH message, first byte of every LEACH header
+enum LeachMessageType
+{
+    LEACH_INVALID = 0,
+    LEACH_ADVERTISEMENT = 1,               ///< Cluster head advertisement, LeachAdvertisementHeader
+    LEACH_JOIN = 2,                        ///< Member joining a cluster head, LeachJoinHeader
+    LEACH_DATA = 3,                        ///< Data record, LeachHeader
+};
+
+/**
+ * Type of the LEACH message p starts with
+ * \param p packet
+ * \return message type, LEACH_INVALID if p is empty or of unknown type
+ */
+LeachMessageType
+PeekMessageType (Ptr<const Packet> p);
+
 /**
  * \ingroup leach
- * \brief LEACH Update Packet Format
+ * \brief LEACH Data Record Header
+ *
+ * All fields are in network byte order. Source is the node that made the
+ * reading, any if unknown, sequence counts readings of the source, and
+ * deadline is given in ms of simulation time, rounded up.
  * \verbatim
- |       0       |       2       |       4       |       6       |
+ |       0       |       1       |       2       |       3       |
   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Boolean pir                         |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .x (Position)                |
+ |  Type (3)     |                    Source                     :
  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .y (Position)                |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .z (Position)                |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .x (Acceleration)            |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .y (Acceleration)            |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Vector .z (Acceleration)            |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |        Member IP to be        |                               |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- |                           Deadline                            |
+ :               |            Sequence           |   Deadline    :
  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :                   Deadline                    |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  * \endverbatim
  */
-
 class LeachHeader : public Header
 {
 public:
-    LeachHeader (BooleanValue PIR = BooleanValue(false), Vector position = Vector(0.0, 0.0, 0.0), Vector acceleration = Vector(0.0, 0.0, 0.0), Ipv4Address address = Ipv4Address("255.255.255.255"), Time m = Time(0));
+    LeachHeader (Ipv4Address source = Ipv4Address::GetAny (), uint16_t sequence = 0, Time deadline = Time(0));
     virtual ~LeachHeader ();
     static TypeId GetTypeId (void);
     virtual TypeId GetInstanceTypeId (void) const;
     virtual uint32_t GetSerializedSize () const;
     virtual void Serialize (Buffer::Iterator start) const;
+    /// Returns 0 and leaves header invalid if start does not hold a data record header
     virtual uint32_t Deserialize (Buffer::Iterator start);
     virtual void Print (std::ostream &os) const;
 
 public:
     void
-    SetPIR (BooleanValue PIR)
+    SetSource (Ipv4Address source)
+    {
+        m_source = source;
+    }
+    Ipv4Address
+    GetSource () const
+    {
+        return m_source;
+    }
+
+    void
+    SetSequence (uint16_t sequence)
+    {
+        m_sequence = sequence;
+    }
+    uint16_t
+    GetSequence () const
+    {
+        return m_sequence;
+    }
+
+    void
+    SetDeadline (Time t)
     {
-        m_PIR = PIR;
+        m_deadline = t;
     }
-    BooleanValue
-    GetPIR () const
+    Time
+    GetDeadline () const
+    {
+        return m_deadline;
+    }
+
+    /// False if last Deserialize did not find a data record header
+    bool
+    IsValid () const
     {
-        return m_PIR;
+        return m_valid;
     }
 
+private:
+    bool m_valid;
+    Ipv4Address m_source;
+    uint16_t m_sequence;
+    Time m_deadline;
+};
+
+inline std::ostream & operator<<(std::ostream& os, const LeachHeader &packet)
+{
+    packet.Print(os);
+    return os;
+}
+
+/**
+ * \ingroup leach
+ * \brief LEACH Cluster Head Advertisement Format
+ *
+ * All fields are in network byte order. Position is given in quarter meters,
+ * in the plane, energy is the fraction of energy left in 1/65535 units.
+ * \verbatim
+ |       0       |       1       |       2       |       3       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |  Type (1)     |          Position .x          |  Position .y  :
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :               |            Energy             |     Round     :
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :                     Round                     |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * \endverbatim
+ */
+class LeachAdvertisementHeader : public Header
+{
+public:
+    LeachAdvertisementHeader (Vector position = Vector(0.0, 0.0, 0.0), double energy = 1.0, uint32_t round = 0);
+    virtual ~LeachAdvertisementHeader ();
+    static TypeId GetTypeId (void);
+    virtual TypeId GetInstanceTypeId (void) const;
+    virtual uint32_t GetSerializedSize () const;
+    virtual void Serialize (Buffer::Iterator start) const;
+    /// Returns 0 and leaves header invalid if start does not hold an advertisement
+    virtual uint32_t Deserialize (Buffer::Iterator start);
+    virtual void Print (std::ostream &os) const;
+
     void
     SetPosition (Vector position)
     {
@@ -73,58 +159,400 @@ public:
         return m_position;
     }
 
+    /// Fraction of energy left, from 0 to 1
     void
-    SetAcceleration (Vector acceleration)
+    SetEnergy (double energy)
+    {
+        m_energy = energy;
+    }
+    double
+    GetEnergy () const
+    {
+        return m_energy;
+    }
+
+    void
+    SetRound (uint32_t round)
+    {
+        m_round = round;
+    }
+    uint32_t
+    GetRound () const
     {
-        m_acceleration = acceleration;
+        return m_round;
     }
-    Vector 
-    GetAcceleration () const
+
+    /// False if last Deserialize did not find an advertisement
+    bool
+    IsValid () const
     {
-        return m_acceleration;
+        return m_valid;
     }
 
+private:
+    bool m_valid;
+    Vector m_position;
+    double m_energy;
+    uint32_t m_round;
+};
+
+/**
+ * \ingroup leach
+ * \brief LEACH Join Format, sent by a member to its cluster head
+ * \verbatim
+ |       0       |       1       |       2       |       3       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |  Type (2)     |                Member address                 :
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :               |
+ +-+-+-+-+-+-+-+-+
+ * \endverbatim
+ */
+class LeachJoinHeader : public Header
+{
+public:
+    LeachJoinHeader (Ipv4Address member = Ipv4Address ());
+    virtual ~LeachJoinHeader ();
+    static TypeId GetTypeId (void);
+    virtual TypeId GetInstanceTypeId (void) const;
+    virtual uint32_t GetSerializedSize () const;
+    virtual void Serialize (Buffer::Iterator start) const;
+    /// Returns 0 and leaves header invalid if start does not hold a join
+    virtual uint32_t Deserialize (Buffer::Iterator start);
+    virtual void Print (std::ostream &os) const;
+
     void
-    SetAddress (Ipv4Address address)
+    SetMember (Ipv4Address member)
     {
-        m_address = address;
+        m_member = member;
     }
     Ipv4Address
-    GetAddress () const
+    GetMember () const
+    {
+        return m_member;
+    }
+
+    /// False if last Deserialize did not find a join
+    bool
+    IsValid () const
     {
-        return m_address;
+        return m_valid;
     }
 
+private:
+    bool m_valid;
+    Ipv4Address m_member;
+};
+
+/**
+ * \ingroup leach
+ * \brief Sensor reading following the LeachHeader of a data record
+ *
+ * Value is an IEEE 754 double, all fields are in network byte order and the
+ * rest of the record after them is padding. A raw reading has function 0 and
+ * counts of 1, a summary record gives the aggregate function that made it,
+ * the number of sources and of readings folded into it.
+ * \verbatim
+ |       0       |       1       |       2       |       3       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                             Value                             |
+ +                                                               +
+ |                                                               |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |   Function    |         Source count          | Reading count :
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :               |
+ +-+-+-+-+-+-+-+-+
+ * \endverbatim
+ */
+class LeachReadingHeader : public Header
+{
+public:
+    LeachReadingHeader (double value = 0.0);
+    virtual ~LeachReadingHeader ();
+    static TypeId GetTypeId (void);
+    virtual TypeId GetInstanceTypeId (void) const;
+    virtual uint32_t GetSerializedSize () const;
+    virtual void Serialize (Buffer::Iterator start) const;
+    virtual uint32_t Deserialize (Buffer::Iterator start);
+    virtual void Print (std::ostream &os) const;
+
     void
-    SetDeadline (Time t)
+    SetValue (double value)
     {
-        m_deadline = t;
+        m_value = value;
+    }
+    double
+    GetValue () const
+    {
+        return m_value;
+    }
+
+    void
+    SetFunction (uint8_t function)
+    {
+        m_function = function;
+    }
+    /// Aggregate function that made the record, 0 for a raw reading
+    uint8_t
+    GetFunction () const
+    {
+        return m_function;
+    }
+
+    void
+    SetSources (uint16_t sources)
+    {
+        m_sources = sources;
+    }
+    uint16_t
+    GetSources () const
+    {
+        return m_sources;
+    }
+
+    void
+    SetCount (uint16_t count)
+    {
+        m_count = count;
+    }
+    uint16_t
+    GetCount () const
+    {
+        return m_count;
+    }
+
+private:
+    double m_value;
+    uint8_t m_function;
+    uint16_t m_sources;
+    uint16_t m_count;
+};
+
+/**
+ * \ingroup leach
+ * \brief LEACH Aggregate Format
+ *
+ * Data packets are aggregates of records, each record is a LeachHeader
+ * followed by the reading. Aggregate header gives the number of records and
+ * the length of each of them, records follow the header back to back.
+ * \verbatim
+ |       0       |       1       |       2       |       3       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |     Marker    |         Record count          |   Length 0    :
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ :   Length 0    |           Length 1            |      ...      
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * \endverbatim
+ */
+class LeachAggregateHeader : public Header
+{
+public:
+    /// First byte of every aggregate
+    static const uint8_t MARKER;
+
+    LeachAggregateHeader ();
+    virtual ~LeachAggregateHeader ();
+    static TypeId GetTypeId (void);
+    virtual TypeId GetInstanceTypeId (void) const;
+    virtual uint32_t GetSerializedSize () const;
+    virtual void Serialize (Buffer::Iterator start) const;
+    /// Returns 0 and leaves header invalid if start does not hold an aggregate header
+    virtual uint32_t Deserialize (Buffer::Iterator start);
+    virtual void Print (std::ostream &os) const;
+
+    /// Append a record of length bytes, length and number of records must fit in 16 bits
+    void
+    AddRecord (uint32_t length);
+    /// Remove all records
+    void
+    Clear ();
+    uint16_t
+    GetRecordCount () const
+    {
+        return m_lengths.size ();
+    }
+    uint16_t
+    GetRecordLength (uint16_t i) const
+    {
+        return m_lengths[i];
+    }
+    /// Total length of all records
+    uint32_t
+    GetRecordBytes () const
+    {
+        return m_bytes;
+    }
+    /// False if last Deserialize did not find an aggregate header
+    bool
+    IsValid () const
+    {
+        return m_valid;
+    }
+    /// True if p is an aggregate holding exactly the records its header lists
+    static bool
+    IsAggregate (Ptr<const Packet> p);
+
+private:
+    bool m_valid;
+    std::vector<uint16_t> m_lengths;
+    uint32_t m_bytes;
+};
+
+/**
+ * \ingroup leach
+ * \brief Deadline and origin of a data packet, kept beside the packet bytes
+ *
+ * WsnApplication attaches the tag to every packet it sends so routing,
+ * queueing and statistics can read deadline, origin, generation time and
+ * sequence without copying the packet or parsing its records. The tag is
+ * simulator metadata and takes no room on the air. Tag of an aggregate
+ * describes it as a whole, deadline and generation time are those of its
+ * most urgent and oldest record, the records themselves still carry their
+ * own LeachHeader.
+ */
+class LeachDataTag : public Tag
+{
+public:
+    LeachDataTag (Ipv4Address origin = Ipv4Address::GetAny (), uint32_t sequence = 0,
+                  Time deadline = Time (0), Time generated = Time (0));
+    static TypeId GetTypeId (void);
+    virtual TypeId GetInstanceTypeId (void) const;
+    virtual uint32_t GetSerializedSize () const;
+    virtual void Serialize (TagBuffer i) const;
+    virtual void Deserialize (TagBuffer i);
+    virtual void Print (std::ostream &os) const;
+
+    void
+    SetOrigin (Ipv4Address origin)
+    {
+        m_origin = origin;
+    }
+    Ipv4Address
+    GetOrigin () const
+    {
+        return m_origin;
+    }
+    void
+    SetSequence (uint32_t sequence)
+    {
+        m_sequence = sequence;
+    }
+    uint32_t
+    GetSequence () const
+    {
+        return m_sequence;
+    }
+    void
+    SetDeadline (Time deadline)
+    {
+        m_deadline = deadline;
     }
     Time
     GetDeadline () const
     {
         return m_deadline;
     }
-
     void
-    TestLeachPacket () const
+    SetGenerated (Time generated)
+    {
+        m_generated = generated;
+    }
+    Time
+    GetGenerated () const
     {
-        std::cout << "TestLeachPacket: " << &m_address << ", " << &m_PIR << &m_position << ", " << &m_acceleration << ", " << &m_deadline << ", " << sizeof(m_deadline) << ", " << sizeof(*this) << std::endl;
+        return m_generated;
     }
 
+    /// Take in the records tagged by other, keeping the earliest deadline and generation time
+    void
+    Merge (LeachDataTag const &other);
+
 private:
-    BooleanValue m_PIR;     ///< (True/False)
-    Vector m_position;      ///< (X, Y, Z) Position
-    Vector m_acceleration;  ///< (X, Y< Z) Acceleration
-    Ipv4Address m_address;
+    Ipv4Address m_origin;
+    uint32_t m_sequence;
     Time m_deadline;
+    Time m_generated;
 };
 
-inline std::ostream & operator<<(std::ostream& os, const LeachHeader &packet)
+/**
+ * \ingroup leach
+ * \brief Reads the records of an aggregate in place
+ *
+ * Reader keeps a copy of the packet, which shares its bytes, and reads the
+ * headers from its front with PeekHeader, dropping each record with
+ * RemoveAtStart once it is read. Walking an aggregate copies no bytes, and
+ * the packet read may be modified meanwhile. A record that has to be kept on
+ * its own is cut out of the original packet with CreateFragment at
+ * GetRecordOffset. Packet may end in the middle of a record, the records not
+ * read yet are then described by GetRemainingHeader.
+ */
+class LeachRecordReader
 {
-    packet.Print(os);
-    return os;
-}
+public:
+    LeachRecordReader ();
+    explicit LeachRecordReader (Ptr<const Packet> p);
+
+    /// Start reading records of p
+    void
+    Reset (Ptr<const Packet> p);
+    /// False if packet does not start with an aggregate header
+    bool
+    IsValid () const
+    {
+        return m_aggregate.IsValid ();
+    }
+    /**
+     * Read header of next complete record
+     * \param header record header
+     * \return false if no complete record is left
+     */
+    bool
+    Next (LeachHeader &header);
+    /**
+     * Read reading of last record read
+     * \param reading record reading
+     * \return false if record is too short to hold a reading
+     */
+    bool
+    GetReading (LeachReadingHeader &reading) const;
+
+    /// Offset of last record read in the packet
+    uint32_t GetRecordOffset () const {return m_recordOffset;}
+    /// Size of last record read, header and reading
+    uint32_t GetRecordSize () const {return m_recordSize;}
+    /// Bytes taken by aggregate header and records read so far
+    uint32_t GetConsumed () const {return m_offset;}
+    /// Bytes after the last record read
+    uint32_t GetRemaining () const {return m_size - m_offset;}
+    /// True if reading stopped at a record the aggregate header lists but whose bytes did not all arrive
+    bool
+    HasPendingRecords () const
+    {
+        return m_aggregate.IsValid () && m_index < m_aggregate.GetRecordCount ()
+            && GetRemaining () < m_aggregate.GetRecordLength (m_index);
+    }
+    /// Aggregate header listing the records not read yet
+    LeachAggregateHeader
+    GetRemainingHeader () const;
+
+private:
+    // Copy of the packet read, starts at the reading of the last record read, or at the first record
+    Ptr<Packet> m_rest;
+    // Bytes of the last record read left at the front of m_rest
+    uint32_t m_skip;
+    LeachAggregateHeader m_aggregate;
+    // Index of the next record
+    uint16_t m_index;
+    uint32_t m_size;
+    uint32_t m_offset;
+    uint32_t m_recordOffset;
+    uint32_t m_recordSize;
+    uint32_t m_recordHeaderSize;
+};
 
 } /* namespace leach */
 } /* namespace ns3   */
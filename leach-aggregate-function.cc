@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <limits>
+
+#include "leach-aggregate-function.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE("LeachAggregateFunction");
+
+namespace leach {
+
+// Counts are 16 bits on the wire
+static uint16_t
+ClampCount (uint32_t count)
+{
+    return std::min<uint32_t> (count, std::numeric_limits<uint16_t>::max ());
+}
+
+AggregateFunction::~AggregateFunction ()
+{
+}
+
+ScalarAggregateFunction::ScalarAggregateFunction (AggregateFunctionType type)
+    : m_type (type),
+      m_count (0),
+      m_value (0)
+{
+}
+
+bool
+ScalarAggregateFunction::Add (Ipv4Address source, LeachHeader const &header, LeachReadingHeader const &reading)
+{
+    if (reading.GetFunction () != 0 && reading.GetFunction () != m_type)
+    {
+        return false;
+    }
+    double value = reading.GetValue ();
+    if (m_count == 0)
+    {
+        m_header = header;
+        m_value = (m_type == AGGREGATE_MIN || m_type == AGGREGATE_MAX) ? value : 0;
+    }
+    else if (header.GetDeadline () < m_header.GetDeadline ())
+    {
+        m_header.SetDeadline (header.GetDeadline ());
+    }
+    switch (m_type)
+    {
+        case AGGREGATE_MIN:
+            m_value = std::min (m_value, value);
+            break;
+        case AGGREGATE_MAX:
+            m_value = std::max (m_value, value);
+            break;
+        case AGGREGATE_SUM:
+            m_value += value;
+            break;
+        case AGGREGATE_MEAN:
+            // Mean of a summary is weighted by the readings it stands for
+            m_value += value*reading.GetCount ();
+            break;
+        case AGGREGATE_COUNT:
+        default:
+            break;
+    }
+    m_count += reading.GetCount ();
+    uint16_t &sources = m_sources[source];
+    sources = std::max (sources, reading.GetSources ());
+    return true;
+}
+
+void
+ScalarAggregateFunction::Flush (std::vector<SummaryRecord> &records)
+{
+    if (m_count == 0)
+    {
+        return;
+    }
+    uint32_t sources = 0;
+    for (std::map<Ipv4Address, uint16_t>::const_iterator i = m_sources.begin (); i != m_sources.end (); ++i)
+    {
+        sources += i->second;
+    }
+    SummaryRecord summary;
+    summary.header = m_header;
+    if (m_sources.size () > 1)
+    {
+        // Summary of several senders has no single source
+        summary.header.SetSource (Ipv4Address::GetAny ());
+    }
+    summary.reading.SetFunction (m_type);
+    summary.reading.SetSources (ClampCount (sources));
+    summary.reading.SetCount (ClampCount (m_count));
+    switch (m_type)
+    {
+        case AGGREGATE_COUNT:
+            summary.reading.SetValue (m_count);
+            break;
+        case AGGREGATE_MEAN:
+            summary.reading.SetValue (m_value/m_count);
+            break;
+        default:
+            summary.reading.SetValue (m_value);
+            break;
+    }
+    NS_LOG_DEBUG("Summary of " << m_count << " readings from " << sources << " sources: " << summary.reading.GetValue ());
+    records.push_back (summary);
+
+    m_count = 0;
+    m_value = 0;
+    m_sources.clear ();
+}
+
+bool
+LastPerSourceFunction::Add (Ipv4Address source, LeachHeader const &header, LeachReadingHeader const &reading)
+{
+    if (reading.GetFunction () != 0 && reading.GetFunction () != AGGREGATE_LAST_PER_SOURCE)
+    {
+        return false;
+    }
+    std::map<Ipv4Address, SummaryRecord>::iterator i = m_last.find (source);
+    if (i == m_last.end ())
+    {
+        SummaryRecord &last = m_last[source];
+        last.header = header;
+        last.reading = reading;
+        last.reading.SetFunction (AGGREGATE_LAST_PER_SOURCE);
+        return true;
+    }
+    Time deadline = std::min (i->second.header.GetDeadline (), header.GetDeadline ());
+    uint32_t count = i->second.reading.GetCount () + reading.GetCount ();
+    i->second.header = header;
+    i->second.header.SetDeadline (deadline);
+    i->second.reading = reading;
+    i->second.reading.SetFunction (AGGREGATE_LAST_PER_SOURCE);
+    i->second.reading.SetCount (ClampCount (count));
+    return true;
+}
+
+void
+LastPerSourceFunction::Flush (std::vector<SummaryRecord> &records)
+{
+    for (std::map<Ipv4Address, SummaryRecord>::const_iterator i = m_last.begin (); i != m_last.end (); ++i)
+    {
+        records.push_back (i->second);
+    }
+    m_last.clear ();
+}
+
+Ptr<AggregateFunction>
+CreateAggregateFunction (AggregateFunctionType type)
+{
+    switch (type)
+    {
+        case AGGREGATE_COUNT:
+        case AGGREGATE_MIN:
+        case AGGREGATE_MAX:
+        case AGGREGATE_SUM:
+        case AGGREGATE_MEAN:
+            return Create<ScalarAggregateFunction> (type);
+        case AGGREGATE_LAST_PER_SOURCE:
+            return Create<LastPerSourceFunction> ();
+        case AGGREGATE_CONCATENATE:
+        default:
+            return 0;
+    }
+}
+
+} /* namespace leach */
+} /* namespace ns3 */
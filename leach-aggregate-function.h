@@ -0,0 +1,124 @@
+#ifndef LEACH_AGGREGATE_FUNCTION_H
+#define LEACH_AGGREGATE_FUNCTION_H
+
+#include <map>
+#include <vector>
+
+#include "LeachPacket.h"
+#include "ns3/ipv4-address.h"
+#include "ns3/ptr.h"
+#include "ns3/simple-ref-count.h"
+
+namespace ns3 {
+namespace leach {
+
+/// Aggregate functions selectable with the AggregateFunction attribute
+enum AggregateFunctionType
+{
+    AGGREGATE_CONCATENATE = 0,             ///< Records are sent as they are
+    AGGREGATE_COUNT = 1,
+    AGGREGATE_MIN = 2,
+    AGGREGATE_MAX = 3,
+    AGGREGATE_SUM = 4,
+    AGGREGATE_MEAN = 5,
+    AGGREGATE_LAST_PER_SOURCE = 6,         ///< Last reading of every source
+};
+
+/// Record made by an aggregate function
+struct SummaryRecord
+{
+    LeachHeader header;
+    LeachReadingHeader reading;
+};
+
+/**
+ * \ingroup leach
+ * \brief Folds the records a node sends into summary records
+ *
+ * RoutingProtocol adds every record of an aggregate it is about to send,
+ * and replaces the records that could be folded by the summary. Readings
+ * are either raw or summaries made by the same function on another node, so
+ * summaries can be folded again on the way to the sink. Summary header is
+ * the header of the first record folded, with the earliest deadline.
+ */
+class AggregateFunction : public SimpleRefCount<AggregateFunction>
+{
+public:
+    virtual ~AggregateFunction ();
+
+    /**
+     * \param source node that sent the record
+     * \param header record header
+     * \param reading record reading
+     * \return false if the record cannot be folded and has to be sent as it is
+     */
+    virtual bool
+    Add (Ipv4Address source, LeachHeader const &header, LeachReadingHeader const &reading) = 0;
+    /**
+     * Append summary of the records added so far to records, and start over
+     * \param records summary records
+     */
+    virtual void
+    Flush (std::vector<SummaryRecord> &records) = 0;
+};
+
+/**
+ * \ingroup leach
+ * \brief Count, minimum, maximum, sum or mean of all readings, in one record
+ *
+ * Source count of the summary adds up the largest source count each sender
+ * reported, which is exact as long as senders summarize disjoint sets of
+ * sources, as cluster members do.
+ */
+class ScalarAggregateFunction : public AggregateFunction
+{
+public:
+    ScalarAggregateFunction (AggregateFunctionType type);
+    virtual bool
+    Add (Ipv4Address source, LeachHeader const &header, LeachReadingHeader const &reading);
+    virtual void
+    Flush (std::vector<SummaryRecord> &records);
+
+private:
+    AggregateFunctionType m_type;
+    LeachHeader m_header;
+    /// Number of readings folded
+    uint32_t m_count;
+    /// Minimum, maximum or sum of readings folded, sum for the mean
+    double m_value;
+    /// Source count reported by each sender
+    std::map<Ipv4Address, uint16_t> m_sources;
+};
+
+/**
+ * \ingroup leach
+ * \brief Last reading of every source, one record per source
+ *
+ * Readings are expected in arrival order. Record of a source carries its
+ * last reading, the earliest deadline of its records and the number of
+ * readings folded into it.
+ */
+class LastPerSourceFunction : public AggregateFunction
+{
+public:
+    virtual bool
+    Add (Ipv4Address source, LeachHeader const &header, LeachReadingHeader const &reading);
+    virtual void
+    Flush (std::vector<SummaryRecord> &records);
+
+private:
+    std::map<Ipv4Address, SummaryRecord> m_last;
+};
+
+/**
+ * Create aggregate function of given type
+ * \param type function type
+ * \return function, or 0 for AGGREGATE_CONCATENATE
+ */
+Ptr<AggregateFunction>
+CreateAggregateFunction (AggregateFunctionType type);
+
+} /* namespace leach */
+} /* namespace ns3 */
+
+#endif /* LEACH_AGGREGATE_FUNCTION_H */
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "leach-aggregation-policy.h"
+#include "ns3/simulator.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE("LeachAggregationPolicy");
+
+namespace leach {
+
+AggregationPolicy::~AggregationPolicy ()
+{
+}
+
+bool
+AggregationPolicy::Admit (Ipv4Address source, double reading)
+{
+    return true;
+}
+
+bool
+ProposalPolicy::ShouldSend (AggregationState const &state)
+{
+  // pick up those selected entry and send
+  int expired = 0;
+  double expected;
+  Time deadLine = Now();
+  
+  // 1.28 = 2*0.64, 0.064 = 64bytes/8kbps
+  deadLine += Seconds(state.queue->GetSize()/std::max(state.drainRate, state.lambda));
+  if(!state.clusterHead)
+    // depend on average tx size from cluster member
+    // depend on deadline setting
+    // * average packet_size?
+    deadLine += Seconds(0.064+1.0/state.lambda);
+
+  // expired entries were already dropped by the queue
+  expired = state.queue->GetCountBefore (deadLine);
+  // records arriving per packet of the node, 1+members for a cluster head in steady state
+  expected = std::max(1.0, state.arrivalRate/state.lambda);
+  
+  NS_LOG_DEBUG("expired: " << expired << ", expected: " << expected);
+  return expired >= expected || state.draining;
+}
+
+OptTMPolicy::OptTMPolicy ()
+    : m_step (0),
+      m_queueVersion (0),
+      m_deadlinesValid (false)
+{
+}
+
+uint32_t
+OptTMPolicy::GetBonus (int n)
+{
+    uint32_t bonus = 0;
+    for(int j=1; j<n && j<BONUS_STEPS; j++)
+    {
+        bonus += 30000-j*4000;
+    }
+    return bonus;
+}
+
+void
+OptTMPolicy::UpdateDeadlines (PacketQueue const &queue)
+{
+    if (m_deadlinesValid && m_queueVersion == queue.GetVersion())
+    {
+        return;
+    }
+    m_deadlines.clear();
+    queue.GetDeadlines(m_deadlines);
+    // Each destination is sorted on its own
+    if (!std::is_sorted(m_deadlines.begin(), m_deadlines.end()))
+    {
+        std::sort(m_deadlines.begin(), m_deadlines.end());
+    }
+    m_suffixMs.assign(m_deadlines.size() + 1, 0);
+    for (int i = (int)m_deadlines.size() - 1; i >= 0; i--)
+    {
+        m_suffixMs[i] = m_suffixMs[i+1] + m_deadlines[i].ToInteger(Time::MS);
+    }
+    m_queueVersion = queue.GetVersion();
+    m_deadlinesValid = true;
+}
+
+uint32_t
+OptTMPolicy::GetSlack (Time t) const
+{
+    uint32_t first = std::lower_bound(m_deadlines.begin(), m_deadlines.end(), t) - m_deadlines.begin();
+    int64_t count = m_deadlines.size() - first;
+    return m_suffixMs[first] - count*t.ToInteger(Time::MS);
+}
+
+bool
+OptTMPolicy::ShouldSend (AggregationState const &state)
+{
+    UpdateDeadlines(*state.queue);
+    // Bonus is the same for every step once m_step passed BONUS_STEPS
+    int bonusStep = std::min(m_step, BONUS_STEPS);
+    m_step++;
+
+    Time time = Now();
+    uint32_t maxR = 0;
+    for(int i=0; i<HORIZON; i++)
+    {
+        m_rewards[i] = GetSlack(time) + GetBonus(i+bonusStep);
+        if(m_rewards[i] > maxR)
+        {
+            maxR = m_rewards[i];
+        }
+        time += Seconds(1/state.lambda);
+    }
+
+    // transmit if sending now is best and beats the value of waiting
+    bool decision = false;
+    if(m_rewards[0] >= maxR)
+    {
+        double rb = 1.0;
+        for(int k=HORIZON-2; k>0; k--)
+        {
+            double rn = std::max(0.0, rb/(k+1));
+            rb = std::max((double)m_rewards[k], rn);
+        }
+        decision = m_rewards[0] >= (uint32_t)rb;
+    }
+  
+    return decision || state.draining;
+}
+
+const uint32_t ControlLimitPolicy::MIN_BATCH;
+
+ControlLimitPolicy::ControlLimitPolicy ()
+    : m_threshold (MIN_BATCH)
+{
+}
+
+uint32_t
+ControlLimitPolicy::GetThreshold (double lambda, double arrivalRate, double drainRate)
+{
+    if (lambda <= 0 || arrivalRate <= 0)
+    {
+        return MIN_BATCH;
+    }
+    // Records arriving between two own packets
+    double batch = arrivalRate / lambda;
+    if (drainRate < arrivalRate)
+    {
+        batch *= drainRate / arrivalRate;
+    }
+    return std::max(MIN_BATCH, static_cast<uint32_t>(std::ceil(batch)));
+}
+
+bool
+ControlLimitPolicy::ShouldSend (AggregationState const &state)
+{
+    uint32_t threshold = GetThreshold(state.lambda, state.arrivalRate, state.drainRate);
+    if (threshold != m_threshold)
+    {
+        NS_LOG_DEBUG("Control limit " << m_threshold << " -> " << threshold << " at lambda " << state.lambda
+                     << ", arrival rate " << state.arrivalRate << ", drain rate " << state.drainRate);
+        m_threshold = threshold;
+    }
+    // expired entries were already dropped by the queue
+    return state.queue->GetSize() >= threshold || state.draining;
+}
+  
+SelectiveForwardingPolicy::SelectiveForwardingPolicy (double hardThreshold, double softThreshold, Time maxReportInterval)
+    : m_hardThreshold (hardThreshold),
+      m_softThreshold (softThreshold),
+      m_maxReportInterval (maxReportInterval)
+{
+}
+
+bool
+SelectiveForwardingPolicy::ShouldSend (AggregationState const &state)
+{
+    // next chance to send is the next packet, 0.064 = 64bytes/8kbps
+    Time due = Now() + Seconds(0.064 + 1.0/state.lambda);
+    return state.deadline < due || state.queue->GetCountBefore(due) > 0 || state.draining;
+}
+
+bool
+SelectiveForwardingPolicy::Admit (Ipv4Address source, double reading)
+{
+    std::map<Ipv4Address, Report>::iterator last = m_lastForwarded.find(source);
+    bool known = last != m_lastForwarded.end();
+    // Source silent for too long reports anyway
+    bool due = known && Now() - last->second.time >= m_maxReportInterval;
+    if (!due && reading < m_hardThreshold)
+    {
+        NS_LOG_DEBUG("Suppress " << reading << " from " << source << ", below hard threshold");
+        return false;
+    }
+    if (!due && known && std::fabs(reading - last->second.reading) < m_softThreshold)
+    {
+        NS_LOG_DEBUG("Suppress " << reading << " from " << source << ", last forwarded " << last->second.reading);
+        return false;
+    }
+    Report &report = m_lastForwarded[source];
+    report.reading = reading;
+    report.time = Now();
+    return true;
+}
+
+Ptr<AggregationPolicy>
+CreateAggregationPolicy (AggregationPolicyType type, double hardThreshold, double softThreshold,
+                         Time maxReportInterval)
+{
+    switch (type)
+    {
+        case AGGREGATION_PROPOSAL:
+            return Create<ProposalPolicy> ();
+        case AGGREGATION_OPT_TM:
+            return Create<OptTMPolicy> ();
+        case AGGREGATION_CONTROL_LIMIT:
+            return Create<ControlLimitPolicy> ();
+        case AGGREGATION_SELECTIVE_FORWARDING:
+            return Create<SelectiveForwardingPolicy> (hardThreshold, softThreshold, maxReportInterval);
+        case AGGREGATION_NONE:
+        default:
+            return 0;
+    }
+}
+
+} /* namespace leach */
+} /* namespace ns3 */
@@ -0,0 +1,221 @@
+#ifndef LEACH_AGGREGATION_POLICY_H
+#define LEACH_AGGREGATION_POLICY_H
+
+#include <map>
+#include <vector>
+
+#include "leach-routing-queue.h"
+#include "ns3/ipv4-address.h"
+#include "ns3/nstime.h"
+#include "ns3/ptr.h"
+#include "ns3/simple-ref-count.h"
+
+namespace ns3 {
+namespace leach {
+
+/// Aggregation policies selectable with the AggregationPolicy attribute
+enum AggregationPolicyType
+{
+    AGGREGATION_NONE = 0,                  ///< Forward every packet as it comes
+    AGGREGATION_PROPOSAL = 1,
+    AGGREGATION_OPT_TM = 2,
+    AGGREGATION_CONTROL_LIMIT = 3,
+    AGGREGATION_SELECTIVE_FORWARDING = 4,
+};
+
+/**
+ * \ingroup leach
+ * \brief Node state an aggregation policy decides on
+ */
+struct AggregationState
+{
+    /// Records waiting to be sent
+    PacketQueue const *queue;
+    /// Destination of the aggregates
+    Ipv4Address sink;
+    /// Packet generation rate of the node, estimated
+    double lambda;
+    /// Records entering the node per second, own and from members, estimated
+    double arrivalRate;
+    /// Records the node sends per second, estimated
+    double drainRate;
+    /// Node is cluster head this round
+    bool clusterHead;
+    /// Number of members of the cluster, if node is cluster head
+    uint32_t clusterMembers;
+    /// Simulation is about to end, everything queued has to go out
+    bool draining;
+    /// Earliest deadline of the records of the aggregate to send
+    Time deadline;
+};
+
+/**
+ * \ingroup leach
+ * \brief Decides when a node sends its queued records
+ *
+ * RoutingProtocol asks the policy every time the node has an aggregate to
+ * send. If the policy says send, all records queued for the sink are merged
+ * into the aggregate, otherwise the aggregate itself is queued. Every record
+ * carrying a reading is offered to Admit once at each node, before it is
+ * queued or sent.
+ */
+class AggregationPolicy : public SimpleRefCount<AggregationPolicy>
+{
+public:
+    virtual ~AggregationPolicy ();
+
+    /**
+     * \param state node state
+     * \return true if the aggregate and queued records are to be sent now
+     */
+    virtual bool
+    ShouldSend (AggregationState const &state) = 0;
+
+    /**
+     * \param source node that sent the record
+     * \param reading record reading
+     * \return false if the record is to be suppressed, by default never
+     */
+    virtual bool
+    Admit (Ipv4Address source, double reading);
+};
+
+/**
+ * \ingroup leach
+ * \brief Send once as many records are due as arrive between two packets of the node
+ */
+class ProposalPolicy : public AggregationPolicy
+{
+public:
+    virtual bool
+    ShouldSend (AggregationState const &state);
+};
+
+/**
+ * \ingroup leach
+ * \brief Optimal stopping over the rewards of the queued deadlines
+ *
+ * Reward of sending after i more packet intervals is the slack left to the
+ * queued deadlines at that time plus a bonus growing with the number of
+ * decisions taken. Node sends now if now has the best reward and it is not
+ * beaten by the backward induction value of waiting.
+ *
+ * Queued deadlines are kept sorted with suffix sums of their values, and
+ * rebuilt only when the queue changes, so the slack at a time is a binary
+ * search. Only the decision for now is needed, so backward induction is run
+ * once per decision.
+ */
+class OptTMPolicy : public AggregationPolicy
+{
+public:
+    OptTMPolicy ();
+    virtual bool
+    ShouldSend (AggregationState const &state);
+
+private:
+    /// Number of future packet intervals looked at
+    static const int HORIZON = 100;
+    /// Number of steps after which bonus stops growing
+    static const int BONUS_STEPS = 8;
+
+    /// Rebuild sorted deadlines if queue changed since last decision
+    void
+    UpdateDeadlines (PacketQueue const &queue);
+    /// Sum over queued deadlines not before t of their distance from t in ms
+    uint32_t
+    GetSlack (Time t) const;
+    /// Bonus for sending n steps from the first decision
+    static uint32_t
+    GetBonus (int n);
+
+    /// Number of decisions taken so far
+    int m_step;
+    /// Deadlines of queued records, sorted
+    std::vector<Time> m_deadlines;
+    /// m_suffixMs[i] is the sum of deadlines i and later in ms
+    std::vector<int64_t> m_suffixMs;
+    /// Queue version m_deadlines was built from
+    uint64_t m_queueVersion;
+    bool m_deadlinesValid;
+    /// Rewards of sending after each interval, buffer reused between decisions
+    uint32_t m_rewards[HORIZON];
+};
+
+/**
+ * \ingroup leach
+ * \brief Send once the queue holds a threshold derived from the measured rates
+ *
+ * Each own packet is a chance to send, so the threshold is the number of
+ * records arriving between two own packets. When records leave slower than
+ * they arrive the queue falls behind, the threshold is then lowered by the
+ * ratio of drain to arrival rate so smaller batches are sent sooner.
+ */
+class ControlLimitPolicy : public AggregationPolicy
+{
+public:
+    ControlLimitPolicy ();
+    virtual bool
+    ShouldSend (AggregationState const &state);
+    /// Queue size at which a batch is sent, never below MIN_BATCH
+    static uint32_t
+    GetThreshold (double lambda, double arrivalRate, double drainRate);
+
+    /// Smallest batch worth sending
+    static const uint32_t MIN_BATCH = 2;
+
+private:
+    /// Threshold of the last decision, changes are logged
+    uint32_t m_threshold;
+};
+
+/**
+ * \ingroup leach
+ * \brief Threshold sensitive forwarding, as in TEEN
+ *
+ * Reading of a source is forwarded only if it is at least the hard
+ * threshold and differs by at least the soft threshold from the last reading
+ * forwarded for that source, other readings are suppressed. As with the count
+ * time of TEEN, a source that reported once is never kept silent for longer
+ * than the maximum report interval, its next reading is then forwarded
+ * whatever its value.
+ * Admitted records are sent as soon as one of them would miss its deadline
+ * waiting for the next packet.
+ */
+class SelectiveForwardingPolicy : public AggregationPolicy
+{
+public:
+    SelectiveForwardingPolicy (double hardThreshold, double softThreshold, Time maxReportInterval);
+    virtual bool
+    ShouldSend (AggregationState const &state);
+    virtual bool
+    Admit (Ipv4Address source, double reading);
+
+private:
+    double m_hardThreshold;
+    double m_softThreshold;
+    Time m_maxReportInterval;
+    struct Report
+    {
+        double reading;
+        Time time;
+    };
+    /// Last reading forwarded for each source, and when
+    std::map<Ipv4Address, Report> m_lastForwarded;
+};
+
+/**
+ * Create policy of given type
+ * \param type policy type
+ * \param hardThreshold smallest reading forwarded by selective forwarding
+ * \param softThreshold smallest change of reading forwarded by selective forwarding
+ * \param maxReportInterval longest time selective forwarding keeps a source silent
+ * \return policy, or 0 for AGGREGATION_NONE
+ */
+Ptr<AggregationPolicy>
+CreateAggregationPolicy (AggregationPolicyType type, double hardThreshold, double softThreshold,
+                         Time maxReportInterval);
+
+} /* namespace leach */
+} /* namespace ns3 */
+
+#endif /* LEACH_AGGREGATION_POLICY_H */
@@ -0,0 +1,39 @@
+#include <cmath>
+
+#include "leach-rate-estimator.h"
+#include "ns3/assert.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+namespace leach {
+
+RateEstimator::RateEstimator (Time timeConstant, double rate)
+{
+    Reset (timeConstant, rate);
+}
+
+void
+RateEstimator::Reset (Time timeConstant, double rate)
+{
+    NS_ASSERT (timeConstant.IsStrictlyPositive ());
+    m_timeConstant = timeConstant.GetSeconds ();
+    m_rate = rate;
+    m_last = Simulator::Now ();
+}
+
+void
+RateEstimator::Notify (uint32_t count)
+{
+    m_rate = GetRate () + count/m_timeConstant;
+    m_last = Simulator::Now ();
+}
+
+double
+RateEstimator::GetRate () const
+{
+    double dt = (Simulator::Now () - m_last).GetSeconds ();
+    return m_rate*std::exp (-dt/m_timeConstant);
+}
+
+} /* namespace leach */
+} /* namespace ns3 */
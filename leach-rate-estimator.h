@@ -0,0 +1,47 @@
+#ifndef LEACH_RATE_ESTIMATOR_H
+#define LEACH_RATE_ESTIMATOR_H
+
+#include "ns3/nstime.h"
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Online estimate of an event rate, exponentially weighted in time
+ *
+ * Every event adds 1/tau to the estimate, which decays by exp(-dt/tau)
+ * between events, so it follows the rate of the last few time constants
+ * and several events at the same instant count as a burst. Estimate starts
+ * from a prior rate which fades out the same way.
+ */
+class RateEstimator
+{
+public:
+    RateEstimator (Time timeConstant = Seconds (5), double rate = 0);
+
+    /**
+     * Forget past events
+     * \param timeConstant averaging time constant, tau
+     * \param rate prior rate in events per second
+     */
+    void
+    Reset (Time timeConstant, double rate);
+    /// Record count events happening now
+    void
+    Notify (uint32_t count = 1);
+    /// Estimated rate now, in events per second
+    double
+    GetRate () const;
+
+private:
+    double m_timeConstant;
+    /// Estimate as of m_last
+    double m_rate;
+    Time m_last;
+};
+
+} /* namespace leach */
+} /* namespace ns3 */
+
+#endif /* LEACH_RATE_ESTIMATOR_H */
@@ -0,0 +1,140 @@
+#include "leach-reassembly-table.h"
+#include "ns3/assert.h"
+#include "ns3/simulator.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE("LeachReassemblyTable");
+
+namespace leach {
+
+ReassemblyTable::ReassemblyTable (uint32_t capacity, Time timeout)
+    : m_capacity (capacity),
+      m_occupancy (0),
+      m_timeout (timeout),
+      m_ageEvictions (0),
+      m_capacityEvictions (0)
+{
+    NS_ASSERT (capacity > 0);
+}
+
+void
+ReassemblyTable::SetCapacity (uint32_t capacity)
+{
+    NS_ASSERT (capacity > 0);
+    Clear ();
+    m_entries.clear ();
+    m_capacity = capacity;
+}
+
+Ptr<Packet>
+ReassemblyTable::Take (uint64_t uid, uint32_t offset)
+{
+    Expire ();
+    for (uint32_t i = 0; i < m_entries.size (); ++i)
+    {
+        if (m_entries[i].packet != 0 && m_entries[i].uid == uid)
+        {
+            Ptr<Packet> p = m_entries[i].packet;
+            uint32_t nextOffset = m_entries[i].nextOffset;
+            Release (i);
+            if (nextOffset != offset)
+            {
+                NS_LOG_DEBUG ("Fragment at " << offset << " does not continue uid " << uid << ", expected " << nextOffset);
+                return 0;
+            }
+            return p;
+        }
+    }
+    return 0;
+}
+
+void
+ReassemblyTable::Store (uint64_t uid, Ptr<Packet> p, uint32_t nextOffset)
+{
+    NS_ASSERT (p != 0);
+    if (m_entries.empty ())
+    {
+        m_entries.resize (m_capacity);
+    }
+    Expire ();
+    uint32_t slot = m_capacity;
+    uint32_t oldest = 0;
+    for (uint32_t i = 0; i < m_capacity; ++i)
+    {
+        if (m_entries[i].packet == 0)
+        {
+            if (slot == m_capacity)
+            {
+                slot = i;
+            }
+            continue;
+        }
+        if (m_entries[i].uid == uid)
+        {
+            slot = i;
+            Release (i);
+            break;
+        }
+        if (m_entries[i].stored < m_entries[oldest].stored || m_entries[oldest].packet == 0)
+        {
+            oldest = i;
+        }
+    }
+    if (slot == m_capacity)
+    {
+        NS_LOG_DEBUG ("Reassembly table full, evict uid " << m_entries[oldest].uid);
+        Release (oldest);
+        m_capacityEvictions++;
+        slot = oldest;
+    }
+    m_entries[slot].uid = uid;
+    m_entries[slot].nextOffset = nextOffset;
+    m_entries[slot].packet = p;
+    m_entries[slot].stored = Simulator::Now ();
+    m_occupancy++;
+    NS_LOG_DEBUG ("Size left " << p->GetSize () << ", on UID " << uid);
+}
+
+void
+ReassemblyTable::Clear ()
+{
+    for (uint32_t i = 0; i < m_entries.size (); ++i)
+    {
+        if (m_entries[i].packet != 0)
+        {
+            Release (i);
+        }
+    }
+}
+
+void
+ReassemblyTable::Expire ()
+{
+    if (m_occupancy == 0)
+    {
+        return;
+    }
+    Time now = Simulator::Now ();
+    for (uint32_t i = 0; i < m_entries.size (); ++i)
+    {
+        if (m_entries[i].packet != 0 && m_entries[i].stored + m_timeout < now)
+        {
+            NS_LOG_DEBUG ("Partial packet uid " << m_entries[i].uid << " timed out");
+            Release (i);
+            m_ageEvictions++;
+        }
+    }
+}
+
+void
+ReassemblyTable::Release (uint32_t i)
+{
+    NS_ASSERT (m_entries[i].packet != 0);
+    m_entries[i].packet = 0;
+    m_occupancy--;
+}
+
+} /* namespace leach */
+} /* namespace ns3 */
@@ -0,0 +1,90 @@
+#ifndef LEACH_REASSEMBLY_TABLE_H
+#define LEACH_REASSEMBLY_TABLE_H
+
+#include <vector>
+#include "ns3/nstime.h"
+#include "ns3/packet.h"
+#include "ns3/ptr.h"
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Partially received aggregates, keyed by packet uid and fragment offset
+ *
+ * An aggregate whose tail did not arrive yet is kept here until the rest of
+ * it comes in. Entry is only handed out to the IP fragment starting where the
+ * stored part ends, a fragment at any other offset means one was lost, and
+ * the entry is released. Table has a fixed number of slots which are only allocated on
+ * first use, an entry is released when the rest of its packet is taken out,
+ * when it is older than the timeout, or when the oldest entry has to make
+ * room for a new one.
+ */
+class ReassemblyTable
+{
+public:
+    ReassemblyTable (uint32_t capacity = 32, Time timeout = Seconds (1));
+
+    /**
+     * Take partial packet stored for uid out of the table
+     * \param uid packet uid
+     * \param offset fragment offset of the fragment continuing it, in bytes
+     * \return stored packet, or 0 if there is none or it does not end at offset
+     */
+    Ptr<Packet>
+    Take (uint64_t uid, uint32_t offset);
+
+    /**
+     * Store partial packet, replaces packet stored for same uid
+     * \param uid packet uid
+     * \param p partial packet
+     * \param nextOffset fragment offset of the fragment expected to continue it, in bytes
+     */
+    void
+    Store (uint64_t uid, Ptr<Packet> p, uint32_t nextOffset);
+
+    /// Release all entries
+    void
+    Clear ();
+
+    // Fields
+    uint32_t GetCapacity () const {return m_capacity;}
+    void SetCapacity (uint32_t capacity);
+    Time GetTimeout () const {return m_timeout;}
+    void SetTimeout (Time t) {m_timeout = t;}
+    /// Number of stored partial packets
+    uint32_t GetOccupancy () const {return m_occupancy;}
+    /// Number of entries released because they timed out
+    uint64_t GetAgeEvictions () const {return m_ageEvictions;}
+    /// Number of entries released to make room for a new one
+    uint64_t GetCapacityEvictions () const {return m_capacityEvictions;}
+
+private:
+    struct Entry
+    {
+        uint64_t uid;
+        uint32_t nextOffset;
+        Ptr<Packet> packet;
+        Time stored;
+    };
+    /// Release timed out entries
+    void
+    Expire ();
+    /// Release entry i
+    void
+    Release (uint32_t i);
+
+    // Slots, empty until first Store
+    std::vector<Entry> m_entries;
+    uint32_t m_capacity;
+    uint32_t m_occupancy;
+    Time m_timeout;
+    uint64_t m_ageEvictions;
+    uint64_t m_capacityEvictions;
+};
+
+} /* namespace leach */
+} /* namespace ns3 */
+
+#endif /* LEACH_REASSEMBLY_TABLE_H */
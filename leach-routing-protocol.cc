@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <vector>
@@ -12,15 +13,12 @@
 #include "ns3/wifi-net-device.h"
 #include "ns3/boolean.h"
 #include "ns3/double.h"
+#include "ns3/energy-source-container.h"
+#include "ns3/enum.h"
 #include "ns3/uinteger.h"
 #include "ns3/vector.h"
 #include "ns3/udp-header.h"
-
-//#define DA
-//#define DA_PROP
-//#define DA_OPT
-//#define DA_CL
-//#define DA_SF
+#include "ns3/udp-l4-protocol.h"
 
 namespace ns3 {
 
@@ -32,10 +30,8 @@ NS_OBJECT_ENSURE_REGISTERED(RoutingProtocol);
 
 /// UDP Port for LEACH control traffic
 const uint32_t RoutingProtocol::LEACH_PORT = 269;
+const uint32_t RoutingProtocol::MAX_LOOPBACK_ROUTES = 256;
 
-double max(double a, double b) {
-    return (a>b)?a:b;
-}
 
 
 TypeId 
@@ -61,13 +57,93 @@ RoutingProtocol::GetTypeId (void)
                        BooleanValue(),
                        MakeBooleanAccessor(&RoutingProtocol::m_PIR),
                        MakeBooleanChecker())
-        .AddAttribute ("lambda", "Average packet generation rate",
+        .AddAttribute ("lambda", "Average packet generation rate, initial value of the rate estimates",
                        DoubleValue(1.0),
                        MakeDoubleAccessor(&RoutingProtocol::m_lambda),
                        MakeDoubleChecker<double>())
+        .AddAttribute ("RateTimeConstant", "Time constant of the packet generation, arrival and drain rate estimates",
+                       TimeValue (Seconds(5)),
+                       MakeTimeAccessor(&RoutingProtocol::m_rateTimeConstant),
+                       MakeTimeChecker(TimeStep(1)))
+        .AddAttribute ("StopTime", "Time the simulation stops, 0 if unknown, then queues are not drained",
+                       TimeValue (Seconds(0)),
+                       MakeTimeAccessor(&RoutingProtocol::m_stopTime),
+                       MakeTimeChecker())
+        .AddAttribute ("DrainMargin", "Time before StopTime from which every packet sent carries all queued records",
+                       TimeValue (Seconds(1.5)),
+                       MakeTimeAccessor(&RoutingProtocol::m_drainMargin),
+                       MakeTimeChecker())
+        .AddAttribute ("DrainInterval", "Interval at which all queued records are flushed in the drain phase",
+                       TimeValue (MilliSeconds(100)),
+                       MakeTimeAccessor(&RoutingProtocol::m_drainInterval),
+                       MakeTimeChecker(TimeStep(1)))
+        .AddAttribute ("AggregationPolicy", "Policy deciding when queued data is aggregated and sent",
+                       EnumValue(AGGREGATION_NONE),
+                       MakeEnumAccessor(&RoutingProtocol::m_aggregationPolicyType),
+                       MakeEnumChecker(AGGREGATION_NONE, "None",
+                                       AGGREGATION_PROPOSAL, "Proposal",
+                                       AGGREGATION_OPT_TM, "OptTM",
+                                       AGGREGATION_CONTROL_LIMIT, "ControlLimit",
+                                       AGGREGATION_SELECTIVE_FORWARDING, "SelectiveForwarding"))
+        .AddAttribute ("AggregateFunction", "Function folding the records a node sends into summary records",
+                       EnumValue(AGGREGATE_CONCATENATE),
+                       MakeEnumAccessor(&RoutingProtocol::m_aggregateFunctionType),
+                       MakeEnumChecker(AGGREGATE_CONCATENATE, "Concatenate",
+                                       AGGREGATE_COUNT, "Count",
+                                       AGGREGATE_MIN, "Min",
+                                       AGGREGATE_MAX, "Max",
+                                       AGGREGATE_SUM, "Sum",
+                                       AGGREGATE_MEAN, "Mean",
+                                       AGGREGATE_LAST_PER_SOURCE, "LastPerSource"))
+        .AddAttribute ("HardThreshold", "Smallest reading forwarded by selective forwarding",
+                       DoubleValue(0.0),
+                       MakeDoubleAccessor(&RoutingProtocol::m_hardThreshold),
+                       MakeDoubleChecker<double>())
+        .AddAttribute ("SoftThreshold", "Smallest change from the last reading forwarded for a source "
+                       "for selective forwarding to forward a reading",
+                       DoubleValue(0.0),
+                       MakeDoubleAccessor(&RoutingProtocol::m_softThreshold),
+                       MakeDoubleChecker<double>(0.0))
+        .AddAttribute ("MaxReportInterval", "Longest time selective forwarding suppresses the readings of a source, "
+                       "its next reading is then forwarded whatever its value",
+                       TimeValue (Seconds(5)),
+                       MakeTimeAccessor(&RoutingProtocol::m_maxReportInterval),
+                       MakeTimeChecker())
+        .AddAttribute ("MaxQueueLen", "Maximum number of packets buffered for aggregation, 0 for no limit",
+                       UintegerValue(0),
+                       MakeUintegerAccessor(&RoutingProtocol::m_maxQueueLen),
+                       MakeUintegerChecker<uint32_t>())
+        .AddAttribute ("MaxQueueBytes", "Maximum number of bytes buffered for aggregation, 0 for no limit",
+                       UintegerValue(0),
+                       MakeUintegerAccessor(&RoutingProtocol::m_maxQueueBytes),
+                       MakeUintegerChecker<uint32_t>())
+        .AddAttribute ("QueueDropPolicy", "Packet dropped when aggregation queue is full",
+                       EnumValue(DROP_TAIL),
+                       MakeEnumAccessor(&RoutingProtocol::m_queueDropPolicy),
+                       MakeEnumChecker(DROP_TAIL, "DropTail",
+                                       DROP_HEAD, "DropHead",
+                                       DROP_EARLIEST_DEADLINE, "DropEarliestDeadline",
+                                       DROP_EXPIRED_FIRST, "DropExpiredFirst"))
+        .AddAttribute ("ReassemblyCapacity", "Maximum number of partially received aggregates held",
+                       UintegerValue(32),
+                       MakeUintegerAccessor(&RoutingProtocol::m_reassemblyCapacity),
+                       MakeUintegerChecker<uint32_t>(1))
+        .AddAttribute ("ReassemblyTimeout", "Time after which a partially received aggregate is released",
+                       TimeValue (Seconds(1)),
+                       MakeTimeAccessor(&RoutingProtocol::m_reassemblyTimeout),
+                       MakeTimeChecker())
         .AddTraceSource ("DroppedCount", "Total Packets dropped",
                        MakeTraceSourceAccessor(&RoutingProtocol::m_dropped),
                        "ns3::TracedValueCallback::Uint32")
+        .AddTraceSource ("DroppedExpired", "Packets dropped from queue past their deadline",
+                       MakeTraceSourceAccessor(&RoutingProtocol::m_droppedExpired),
+                       "ns3::TracedValueCallback::Uint32")
+        .AddTraceSource ("DroppedOverflow", "Packets dropped because queue was full",
+                       MakeTraceSourceAccessor(&RoutingProtocol::m_droppedOverflow),
+                       "ns3::TracedValueCallback::Uint32")
+        .AddTraceSource ("Suppressed", "Records suppressed by the aggregation policy",
+                       MakeTraceSourceAccessor(&RoutingProtocol::m_suppressed),
+                       "ns3::TracedValueCallback::Uint32")
         ;
 
     return tid;
@@ -117,6 +193,18 @@ RoutingProtocol::getTxTime()
     return &tx_time;
 }
 
+uint32_t
+RoutingProtocol::GetReassemblyOccupancy() const
+{
+    return m_reassembly.GetOccupancy();
+}
+
+uint64_t
+RoutingProtocol::GetReassemblyEvictions() const
+{
+    return m_reassembly.GetAgeEvictions() + m_reassembly.GetCapacityEvictions();
+}
+
 int64_t
 RoutingProtocol::AssignStreams(int64_t stream)
 {
@@ -137,7 +225,28 @@ RoutingProtocol::RoutingProtocol()
   : Round(0),
     isSink(0),
     m_dropped(0),
+    m_droppedExpired(0),
+    m_droppedOverflow(0),
+    m_suppressed(0),
+    m_maxQueueLen(0),
+    m_maxQueueBytes(0),
+    m_queueDropPolicy(DROP_TAIL),
     m_lambda(4.0),
+    m_rateTimeConstant(Seconds(5)),
+    m_stopTime(Seconds(0)),
+    m_drainMargin(Seconds(1.5)),
+    m_draining(false),
+    m_drainInterval(MilliSeconds(100)),
+    m_dataSourcePort(0),
+    m_dataDestinationPort(0),
+    m_aggregationPolicyType(AGGREGATION_NONE),
+    m_hardThreshold(0.0),
+    m_softThreshold(0.0),
+    m_maxReportInterval(Seconds(5)),
+    m_aggregateFunctionType(AGGREGATE_CONCATENATE),
+    m_reassembly(),
+    m_reassemblyCapacity(32),
+    m_reassemblyTimeout(Seconds(1)),
     timeline(),
     tx_time(),
     m_routingTable(),
@@ -145,10 +254,12 @@ RoutingProtocol::RoutingProtocol()
     m_queue(),
     m_periodicUpdateTimer(Timer::CANCEL_ON_DESTROY),
     m_broadcastClusterHeadTimer (Timer::CANCEL_ON_DESTROY),
-    m_respondToClusterHeadTimer (Timer::CANCEL_ON_DESTROY)
+    m_respondToClusterHeadTimer (Timer::CANCEL_ON_DESTROY),
+    m_drainTimer (Timer::CANCEL_ON_DESTROY)
     {
         m_uniformRandomVariable = CreateObject<UniformRandomVariable> ();
-        for (int i = 0; i < 1021; i++) m_hash[i] = NULL;
+        m_queue.SetDropCallback (MakeCallback (&RoutingProtocol::QueueDrop, this));
+        m_routingTable.SetRemoveCallback (MakeCallback (&RoutingProtocol::RouteRemoved, this));
     }
 
 RoutingProtocol::~RoutingProtocol()
@@ -165,6 +276,13 @@ RoutingProtocol::DoDispose()
         iter->first->Close();
     }
     m_socketAddress.clear();
+    m_interfaceIndex.clear();
+    m_localAddressIndex.clear();
+    m_loopbackRoutes.clear();
+    m_queue.Clear();
+    m_reassembly.Clear();
+    m_aggregationPolicy = 0;
+    m_aggregateFunction = 0;
     Ipv4RoutingProtocol::DoDispose();
 }
 
@@ -196,9 +314,25 @@ RoutingProtocol::Start ()
     {
         Round = 0;
         m_routingTable.SetHoldDownTime (Time (m_periodicUpdateInterval));
+        m_queue.SetMaxLen (m_maxQueueLen);
+        m_queue.SetMaxBytes (m_maxQueueBytes);
+        m_queue.SetDropPolicy (m_queueDropPolicy);
+        m_reassembly.SetCapacity (m_reassemblyCapacity);
+        m_reassembly.SetTimeout (m_reassemblyTimeout);
+        m_aggregationPolicy = CreateAggregationPolicy (m_aggregationPolicyType, m_hardThreshold, m_softThreshold, m_maxReportInterval);
+        m_aggregateFunction = CreateAggregateFunction (m_aggregateFunctionType);
+        m_generationRate.Reset (m_rateTimeConstant, m_lambda);
+        m_arrivalRate.Reset (m_rateTimeConstant, m_lambda);
+        m_drainRate.Reset (m_rateTimeConstant, m_lambda);
         m_periodicUpdateTimer.SetFunction (&RoutingProtocol::PeriodicUpdate, this);
         m_broadcastClusterHeadTimer.SetFunction (&RoutingProtocol::SendBroadcast, this);
         m_respondToClusterHeadTimer.SetFunction (&RoutingProtocol::RespondToClusterHead, this);
+        if (m_stopTime.IsStrictlyPositive ())
+        {
+            Time drain = m_stopTime - m_drainMargin;
+            m_drainTimer.SetFunction (&RoutingProtocol::Drain, this);
+            m_drainTimer.Schedule (drain > Now () ? drain - Now () : Time (0));
+        }
         m_periodicUpdateTimer.Schedule (MicroSeconds (m_uniformRandomVariable->GetInteger(10,1000)));
     }
 }
@@ -207,31 +341,52 @@ Ptr<Ipv4Route>
 RoutingProtocol::LoopbackRoute(const Ipv4Header &header, Ptr<NetDevice> oif) const
 {
     NS_ASSERT (m_lo != 0);
-    Ptr<Ipv4Route> route = Create<Ipv4Route> ();
-    route->SetDestination(header.GetDestination());
+    Ipv4Address source;
 
-    std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin();
     if (oif)
     {
-        // Iterate to find addressof oif device
-        for (j = m_socketAddress.begin(); j != m_socketAddress.end(); ++j)
+        // Address of oif device
+        int32_t interface = m_ipv4->GetInterfaceForDevice(oif);
+        if (interface >= 0 && static_cast<uint32_t>(interface) < m_interfaceIndex.size()
+            && m_interfaceIndex[interface].socket)
         {
-            Ipv4Address addr = j->second.GetLocal();
-            int32_t interface = m_ipv4->GetInterfaceForAddress(addr);
-            if (oif == m_ipv4->GetNetDevice(static_cast<uint32_t>(interface)))
+            source = m_interfaceIndex[interface].local;
+        }
+    }
+    else
+    {
+        for (std::vector<LocalInterface>::const_iterator j = m_interfaceIndex.begin(); j != m_interfaceIndex.end(); ++j)
+        {
+            if (j->socket)
             {
-                route->SetSource(addr);
+                source = j->local;
                 break;
             }
         }
     }
-    else
+    NS_ASSERT_MSG(source != Ipv4Address(), "Valid Leach source address not found");
+    return GetLoopbackRoute(header.GetDestination(), source);
+}
+
+Ptr<Ipv4Route>
+RoutingProtocol::GetLoopbackRoute(Ipv4Address dst, Ipv4Address src) const
+{
+    std::pair<Ipv4Address, Ipv4Address> key (dst, src);
+    LoopbackRouteCache::const_iterator i = m_loopbackRoutes.find(key);
+    if (i != m_loopbackRoutes.end())
+    {
+        return i->second;
+    }
+    if (m_loopbackRoutes.size() >= MAX_LOOPBACK_ROUTES)
     {
-        route->SetSource(j->second.GetLocal());
+        m_loopbackRoutes.clear();
     }
-    NS_ASSERT_MSG(route->GetSource() != Ipv4Address(), "Valid Leach source address not found");
+    Ptr<Ipv4Route> route = Create<Ipv4Route> ();
+    route->SetDestination(dst);
+    route->SetSource(src);
     route->SetGateway(Ipv4Address("127.0.0.1"));
     route->SetOutputDevice(m_lo);
+    m_loopbackRoutes.insert(std::make_pair(key, route));
     return route;
 }
 
@@ -268,81 +423,72 @@ RoutingProtocol::RouteInput(Ptr<const Packet> p, const Ipv4Header &header, Ptr<c
     if (idev == m_lo)
     {
         NS_LOG_DEBUG("Loopback Route");
-#ifdef DA
-        Ptr<Packet> pa = new Packet(*p);
-        EnqueuePacket (pa, header);
-        return false;
-#else
-        RoutingTableEntry toDst;
+        if (m_aggregationPolicy != 0)
+        {
+            Ptr<Packet> pa = new Packet(*p);
+            EnqueuePacket (pa, header);
+            return false;
+        }
         NS_LOG_DEBUG("Deferred: " << dst);
 
-        if (m_routingTable.LookupRoute(dst, toDst))
+        const ForwardingCacheEntry *cached = FindForwardingCache(dst);
+        const RoutingTableEntry *toDst = 0;
+        if (cached != 0)
+            {
+                NS_LOG_DEBUG("Deferred forwarding, cached route");
+                ucb(cached->route, p, header);
+            }
+        else if ((toDst = m_routingTable.FindRoute(dst)) != 0)
             {
-                Ptr<Ipv4Route> route = toDst.GetRoute();
+                Ptr<Ipv4Route> route = toDst->GetRoute();
                 NS_LOG_DEBUG("Deferred forwarding");
-                NS_LOG_DEBUG("Src: " << route->GetSource() << ", Dst: " << toDst.GetDestination() << ", Gateway: " << toDst.GetNextHop());
+                NS_LOG_DEBUG("Src: " << route->GetSource() << ", Dst: " << toDst->GetDestination() << ", Gateway: " << toDst->GetNextHop());
                 ucb(route, p, header);
             }
         else 
         {
             NS_LOG_DEBUG("Route not found");
-            Ptr<Ipv4Route> route = Create<Ipv4Route> ();
-            route->SetDestination(dst);
-            route->SetSource(origin);
-            route->SetGateway(Ipv4Address ("127.0.0.1"));
-            route->SetOutputDevice(m_lo);
-            EnqueueForNoDA(ucb, route, p, header);
+            EnqueueForNoDA(ucb, GetLoopbackRoute(dst, origin), p, header);
         }
         return true;
-#endif
     }
-    for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin();
-            j != m_socketAddress.end(); ++j)
+    if (m_localAddressIndex.find(origin) != m_localAddressIndex.end())
     {
-        Ipv4InterfaceAddress iface = j->second;
-        if (origin == iface.GetLocal())
-        {
-            return true;
-        }
+        return true;
     }
 
-    // Local Delivery to each leach interface
-    for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin();
-            j != m_socketAddress.end(); ++j)
+    // Local Delivery to leach interface
+    if (static_cast<uint32_t>(iif) < m_interfaceIndex.size() && m_interfaceIndex[iif].socket)
     {
-        Ipv4InterfaceAddress iface = j->second;
-        if (m_ipv4->GetInterfaceForAddress(iface.GetLocal()) == iif)
+        const LocalInterface &iface = m_interfaceIndex[iif];
+        // Ignore Broadcast
+        if (dst == iface.broadcast || dst.IsBroadcast())
         {
-            // Ignore Broadcast
-            if (dst == iface.GetBroadcast() || dst.IsBroadcast())
+            Ptr<Packet> packet = p->Copy();
+            if (lcb.IsNull())
             {
-                Ptr<Packet> packet = p->Copy();
-                if (lcb.IsNull())
-                {
-                    NS_LOG_ERROR ("Unable to deliver packet locally due to null callback " << p->GetUid () << " from " << origin);
-                    ecb (p, header, Socket::ERROR_NOROUTETOHOST);
-                }
-                else
+                NS_LOG_ERROR ("Unable to deliver packet locally due to null callback " << p->GetUid () << " from " << origin);
+                ecb (p, header, Socket::ERROR_NOROUTETOHOST);
+            }
+            else
+            {
+                  NS_LOG_LOGIC ("Broadcast local delivery to " << iface.local);
+                  lcb (p, header, iif);
+            }
+            if (header.GetTtl() > 1)
+            {
+                NS_LOG_LOGIC("Forwarding Broadcast. TTL " << (uint16_t) header.GetTtl());
+                const RoutingTableEntry *toBroadcast = m_routingTable.FindRoute(dst, true);
+                if (toBroadcast != 0)
                 {
-                      NS_LOG_LOGIC ("Broadcast local delivery to " << iface.GetLocal ());
-                      lcb (p, header, iif);
+                    ucb (toBroadcast->GetRoute(), packet, header);
                 }
-                if (header.GetTtl() > 1)
+                else 
                 {
-                    NS_LOG_LOGIC("Forwarding Broadcast. TTL " << (uint16_t) header.GetTtl());
-                    RoutingTableEntry toBroadcast;
-                    if (m_routingTable.LookupRoute(dst, toBroadcast, true))
-                    {
-                        Ptr<Ipv4Route> route = toBroadcast.GetRoute();
-                        ucb (route, packet, header);
-                    }
-                    else 
-                    {
-                        NS_LOG_DEBUG("No route to forward. Drop Packet " << p->GetUid());
-                    }
+                    NS_LOG_DEBUG("No route to forward. Drop Packet " << p->GetUid());
                 }
-                return true;
             }
+            return true;
         }
     }
 
@@ -371,37 +517,42 @@ RoutingProtocol::RouteInput(Ptr<const Packet> p, const Ipv4Header &header, Ptr<c
     }
 
     // Enqueue, not send
-    RoutingTableEntry toDst;
-    if (m_routingTable.LookupRoute(dst, toDst))
+    Ptr<Ipv4Route> nextHopRoute;
+    const ForwardingCacheEntry *cached = FindForwardingCache(dst);
+    if (cached != 0)
+    {
+        nextHopRoute = cached->nextHopRoute;
+    }
+    else
     {
-        RoutingTableEntry ne;
-        if (m_routingTable.LookupRoute(toDst.GetNextHop(), ne))
+        const RoutingTableEntry *toDst = m_routingTable.FindRoute(dst);
+        const RoutingTableEntry *ne = (toDst != 0) ? m_routingTable.FindRoute(toDst->GetNextHop()) : 0;
+        if (ne != 0)
+        {
+            nextHopRoute = ne->GetRoute();
+        }
+    }
+    if (nextHopRoute)
+    {
+        NS_LOG_LOGIC(m_mainAddress << " is forwarding packet "  << p->GetUid()
+                                   << " to "                    << dst
+                                   << " from "                  << header.GetSource()
+                                   << " via nexthop neighbour " << nextHopRoute->GetGateway());
+        if (m_aggregationPolicy != 0)
         {
-            Ptr<Ipv4Route> route = ne.GetRoute();
-            NS_LOG_LOGIC(m_mainAddress << " is forwarding packet "  << p->GetUid()
-                                       << " to "                    << dst
-                                       << " from "                  << header.GetSource()
-                                       << " via nexthop neighbour " << toDst.GetNextHop());
-#ifdef DA
             Ptr<Packet> pa = new Packet(*p);
             EnqueuePacket(pa, header);
             return false;
-#else
-            ucb (route, p, header);
-            return true;
-#endif
         }
+        ucb (nextHopRoute, p, header);
+        return true;
     }
-#ifndef DA
-    NS_LOG_DEBUG("Route not found");
+    if (m_aggregationPolicy == 0)
+    {
+        NS_LOG_DEBUG("Route not found");
 
-    Ptr<Ipv4Route> route = Create<Ipv4Route> ();
-    route->SetDestination(dst);
-    route->SetSource(origin);
-    route->SetGateway(Ipv4Address ("127.0.0.1"));
-    route->SetOutputDevice(m_lo);
-    EnqueueForNoDA(ucb, route, p, header);
-#endif
+        EnqueueForNoDA(ucb, GetLoopbackRoute(dst, origin), p, header);
+    }
     return false;
 }
 
@@ -421,40 +572,38 @@ RoutingProtocol::RouteOutput(Ptr<Packet> p, const Ipv4Header &header, Ptr<NetDev
     }
 
     Ipv4Address dst = header.GetDestination();
-    RoutingTableEntry rt;
+    const ForwardingCacheEntry *cached = FindForwardingCache(dst);
+    const RoutingTableEntry *rt = 0;
     NS_LOG_DEBUG("Packet Size: " << p->GetSize () << ", " << 
                  "Packet id: "   << p->GetUid ()  << ", " << 
                  "Destination address in Packet: " << dst);
 
-#ifdef DA
-    if (p->GetSize()%56 == 0)
+    // Without aggregation every packet is sent, aggregates wait until the policy sends them.
+    // Control packets are routed directly and left out of the statistics.
+    bool data = LeachAggregateHeader::IsAggregate(p);
+    bool aggregating = m_aggregationPolicy != 0 && data;
+    if (!aggregating || DataAggregation(p))
     {
-        if (DataAggregation(p))
+        if (cached != 0 || (rt = m_routingTable.FindRoute(dst)) != 0)
         {
-#endif           
-            if (m_routingTable.LookupRoute(dst, rt))
+            if (data)
             {
                 tx_time.push_back(Simulator::Now());
+            }
 
-                Ptr<Packet> packet = new Packet(*p);
-                LeachHeader hdr;
+            // Earliest deadline of the packet, from its tag, packet is not read
+            LeachDataTag tag;
+            if (data && p->PeekPacketTag(tag))
+            {
                 struct ns3::leach::msmt tmp;
-
-                packet->RemoveHeader(hdr);
                 tmp.begin = Simulator::Now();
-                tmp.end = hdr.GetDeadline();
+                tmp.end = tag.GetDeadline();
                 timeline.push_back(tmp);
-
-                return rt.GetRoute();
             }
-#ifdef DA
+
+            return (cached != 0) ? cached->route : rt->GetRoute();
         }
     }
-    else if (m_routingTable.LookupRoute(dst, rt))
-    {
-        return rt.GetRoute();
-    }
-#endif
     return LoopbackRoute(header, oif);
 }
 
@@ -490,48 +639,49 @@ RoutingProtocol::RecvLeach (Ptr<Socket> socket)
     Ipv4Address sender = inetSourceAddr.GetIpv4 ();
     Ipv4Address receiver = m_socketAddress[socket].GetLocal ();
     double dist, dx, dy;
-    LeachHeader leachHeader;
+    LeachAdvertisementHeader advertisement;
+    LeachJoinHeader join;
     Vector senderPosition;
   
     // maintain list of received advertisements
     // always choose the closest CH to join in
     // if itself is CH, pass this phase
-    packet->RemoveHeader(leachHeader);
-    
-    /*
-    NS_LOG_DEBUG(leachHeader.GetAddress());
-    NS_LOG_DEBUG(isSink);
-    NS_LOG_DEBUG(m_mainAddress);
-    */
-  
     if(isSink) return;
-    if(leachHeader.GetAddress() == Ipv4Address("255.255.255.255")) 
-    {
-        NS_LOG_DEBUG("Recv broadcast from CH: " << sender);
-        // Need to update a new route
-        RoutingTableEntry newEntry ( socket->GetBoundNetDevice(), /*device*/
-                                     m_sinkAddress, /*dst (sink)*/
-                                     m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0), /*iface*/
-                                     sender); /*next hop*/
+    switch (PeekMessageType(packet))
+    {
+        case LEACH_ADVERTISEMENT:
+        {
+            packet->RemoveHeader(advertisement);
+            NS_LOG_DEBUG("Recv broadcast from CH: " << sender << ", energy " << advertisement.GetEnergy() << ", round " << advertisement.GetRound());
+            // Need to update a new route
+            RoutingTableEntry newEntry ( socket->GetBoundNetDevice(), /*device*/
+                                         m_sinkAddress, /*dst (sink)*/
+                                         m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0), /*iface*/
+                                         sender); /*next hop*/
       
-        senderPosition = leachHeader.GetPosition();
-        dx = senderPosition.x - m_position.x;
-        dy = senderPosition.y - m_position.y;
-        dist = dx*dx + dy*dy;
-        NS_LOG_DEBUG("dist = " << dist << ", m_dist = " << m_dist);
+            senderPosition = advertisement.GetPosition();
+            dx = senderPosition.x - m_position.x;
+            dy = senderPosition.y - m_position.y;
+            dist = dx*dx + dy*dy;
+            NS_LOG_DEBUG("dist = " << dist << ", m_dist = " << m_dist);
       
-        if(dist < m_dist) 
-        {
-            m_dist = dist;
-            m_targetAddress = sender;
-            m_bestRoute = newEntry;
-            NS_LOG_DEBUG(sender);
+            if(dist < m_dist) 
+            {
+                m_dist = dist;
+                m_targetAddress = sender;
+                m_bestRoute = newEntry;
+                NS_LOG_DEBUG(sender);
+            }
+            break;
         }
-    }
-    else 
-    {
-        // Record cluster member
-        m_clusterMember.push_back(leachHeader.GetAddress());
+        case LEACH_JOIN:
+            packet->RemoveHeader(join);
+            // Record cluster member
+            m_clusterMember.push_back(join.GetMember());
+            break;
+        default:
+            NS_LOG_DEBUG("Drop LEACH message of unknown type from " << sender);
+            break;
     }
 }
 
@@ -540,7 +690,7 @@ RoutingProtocol::RespondToClusterHead()
 {
     Ptr<Socket> socket = FindSocketWithAddress(m_mainAddress);
     Ptr<Packet> packet = Create<Packet> ();
-    LeachHeader leachHeader;
+    LeachJoinHeader join (m_mainAddress);
     Ipv4Address ipv4;
     OutputStreamWrapper temp = OutputStreamWrapper(&std::cout);
 
@@ -548,36 +698,108 @@ RoutingProtocol::RespondToClusterHead()
     // Add routing to routingTable
     if(m_targetAddress != ipv4) 
     {
-        RoutingTableEntry newEntry, entry2;
-        newEntry.Copy(m_bestRoute);
-        entry2.Copy(m_bestRoute);
-        Ptr<Ipv4Route> newRoute = newEntry.GetRoute();
-        newRoute->SetDestination(m_targetAddress);
-        newEntry.SetRoute(newRoute);
+        // Route to sink through the closest cluster head, and to the cluster head itself
+        RoutingTableEntry newEntry (m_bestRoute), entry2 (m_bestRoute);
+        newEntry.SetDestination(m_targetAddress);
 
         if(m_bestRoute.GetInterface().GetLocal() != ipv4) m_routingTable.AddRoute (entry2);
         if(newEntry.GetInterface().GetLocal() != ipv4) m_routingTable.AddRoute (newEntry);
+        CacheForwardingRoute (FWD_CLUSTER_HEAD, m_targetAddress);
+        CacheForwardingRoute (FWD_SINK, m_sinkAddress);
 
         // m_routingTable.Print(&temp);
       
-        leachHeader.SetAddress(m_mainAddress);
-        packet->AddHeader (leachHeader);
+        packet->AddHeader (join);
         socket->SendTo (packet, 0, InetSocketAddress (m_targetAddress, LEACH_PORT));
     }
 }
 
+void
+RoutingProtocol::Drain ()
+{
+    if (!m_draining)
+    {
+        NS_LOG_DEBUG("Drain phase, " << m_queue.GetSize() << " records queued");
+        m_draining = true;
+    }
+    // Records keep arriving until the end, queues are flushed without waiting for own packets
+    std::vector<Ipv4Address> destinations;
+    m_queue.GetDestinations(destinations);
+    for (std::vector<Ipv4Address>::const_iterator i = destinations.begin(); i != destinations.end(); ++i)
+    {
+        FlushQueued(*i);
+    }
+    if (Now () + m_drainInterval < m_stopTime)
+    {
+        m_drainTimer.Schedule (m_drainInterval);
+    }
+}
+
+bool
+RoutingProtocol::FlushQueued (Ipv4Address dst)
+{
+    const ForwardingCacheEntry *cached = FindForwardingCache(dst);
+    const RoutingTableEntry *rt = 0;
+    if (cached == 0 && (rt = m_routingTable.FindRoute(dst)) == 0)
+    {
+        NS_LOG_DEBUG("No route to " << dst << ", " << m_queue.GetCountForPacketsWithDst(dst) << " records stay queued");
+        return false;
+    }
+    Ptr<Ipv4Route> route = (cached != 0) ? cached->route : rt->GetRoute();
+    Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+    NS_ASSERT (l3 != 0);
+
+    // Fresh aggregate with no records of its own, its tag is narrowed by the queued ones
+    Ptr<Packet> p = Create<Packet> ();
+    p->AddHeader(LeachAggregateHeader ());
+    p->AddPacketTag(LeachDataTag (m_mainAddress, 0, Time::Max (), Now ()));
+    uint32_t count = MergeQueued(p, dst);
+    if (count == 0)
+    {
+        return true;
+    }
+    m_drainRate.Notify(count);
+
+    LeachDataTag tag;
+    p->PeekPacketTag(tag);
+    tx_time.push_back(Simulator::Now());
+    struct ns3::leach::msmt tmp;
+    tmp.begin = Simulator::Now();
+    tmp.end = tag.GetDeadline();
+    timeline.push_back(tmp);
+
+    // Route is given, l3 sends it without asking RouteOutput again
+    UdpHeader udpHeader;
+    udpHeader.SetSourcePort(m_dataSourcePort);
+    udpHeader.SetDestinationPort(m_dataDestinationPort);
+    p->AddHeader(udpHeader);
+    NS_LOG_DEBUG("Drained " << count << " records to " << dst << " in packet " << p->GetUid ());
+    l3->Send (p, route->GetSource (), dst, UdpL4Protocol::PROT_NUMBER, route);
+    return true;
+}
+
+double
+RoutingProtocol::GetEnergyFraction () const
+{
+    Ptr<EnergySourceContainer> sources = m_ipv4->GetObject<Node> ()->GetObject<EnergySourceContainer> ();
+    if (sources == 0 || sources->GetN () == 0)
+    {
+        return 1.0;
+    }
+    return sources->Get (0)->GetEnergyFraction ();
+}
+
 void
 RoutingProtocol::SendBroadcast ()
 {
     Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
     Ptr<Packet> packet = Create<Packet> ();
-    LeachHeader leachHeader;
+    LeachAdvertisementHeader advertisement (m_position, GetEnergyFraction (), Round);
     Ipv4Address destination = Ipv4Address ("10.1.1.255");;
 
     socket->SetAllowBroadcast (true);
 
-    leachHeader.SetPosition (m_position);
-    packet->AddHeader (leachHeader);
+    packet->AddHeader (advertisement);
     socket->SendTo (packet, 0, InetSocketAddress (destination, LEACH_PORT));
     
     RoutingTableEntry newEntry (
@@ -586,6 +808,7 @@ RoutingProtocol::SendBroadcast ()
         /*iface=*/     m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (m_mainAddress), 0),
         /*next hop=*/  m_sinkAddress);
     m_routingTable.AddRoute (newEntry);
+    CacheForwardingRoute (FWD_SINK, m_sinkAddress);
 }
   
 void
@@ -600,8 +823,10 @@ RoutingProtocol::PeriodicUpdate ()
     NS_LOG_DEBUG("PeriodicUpdate!!");
     //  NS_LOG_DEBUG("prob = " << prob << ", t = " << t);
 
-    m_routingTable.DeleteRoute(m_targetAddress);
-    m_routingTable.DeleteRoute(m_sinkAddress);
+    // Last round's routes are held down, new ones replace them as they are installed
+    m_routingTable.HoldDownRoute(m_targetAddress);
+    m_routingTable.HoldDownRoute(m_sinkAddress);
+    InvalidateForwardingCache();
     /*
       OutputStreamWrapper temp = OutputStreamWrapper(&std::cout);
       m_routingTable.Print(&temp);
@@ -672,6 +897,7 @@ RoutingProtocol::NotifyInterfaceUp (uint32_t i)
     socket->SetAllowBroadcast (true);
     socket->SetAttribute ("IpTtl",UintegerValue (1));
     m_socketAddress.insert (std::make_pair (socket,iface));
+    RebuildInterfaceIndex ();
     // Add local broadcast record to the routing table
     Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()));
     RoutingTableEntry rt (/*device=*/ dev, /*dst=*/ iface.GetBroadcast (),/*iface=*/ iface, /*next hop=*/ iface.GetBroadcast ());
@@ -692,6 +918,8 @@ RoutingProtocol::NotifyInterfaceDown (uint32_t i)
     NS_ASSERT (socket);
     socket->Close ();
     m_socketAddress.erase (socket);
+    RebuildInterfaceIndex ();
+    InvalidateForwardingCache ();
     if (m_socketAddress.empty ())
     {
       NS_LOG_LOGIC ("No leach interfaces");
@@ -727,6 +955,7 @@ RoutingProtocol::NotifyAddAddress (uint32_t i,
         socket->BindToNetDevice (l3->GetNetDevice (i));
         socket->SetAllowBroadcast (true);
         m_socketAddress.insert (std::make_pair (socket,iface));
+        RebuildInterfaceIndex ();
         Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()));
         RoutingTableEntry rt (/*device=*/ dev, /*dst=*/ iface.GetBroadcast (), /*iface=*/ iface, /*next hop=*/ iface.GetBroadcast ());
         m_routingTable.AddRoute (rt);
@@ -741,6 +970,7 @@ RoutingProtocol::NotifyRemoveAddress (uint32_t i,
     if (socket)
     {
         m_socketAddress.erase (socket);
+        InvalidateForwardingCache ();
         Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
         if (l3->GetNAddresses(i))
         {
@@ -754,34 +984,119 @@ RoutingProtocol::NotifyRemoveAddress (uint32_t i,
             socket->SetAllowBroadcast (true);
             m_socketAddress.insert (std::make_pair (socket,iface));
         }
+        RebuildInterfaceIndex ();
     }
 }
 
-Ptr<Socket>
-RoutingProtocol::FindSocketWithAddress (Ipv4Address addr) const
+void
+RoutingProtocol::CacheForwardingRoute (ForwardingCacheSlot slot, Ipv4Address dst)
+{
+    ForwardingCacheEntry &entry = m_forwardingCache[slot];
+    entry.dst = dst;
+    entry.route = 0;
+    entry.nextHopRoute = 0;
+    // Same two lookups RouteOutput and RouteInput would do per packet
+    const RoutingTableEntry *toDst = m_routingTable.FindRoute (dst);
+    if (toDst == 0)
+    {
+        return;
+    }
+    const RoutingTableEntry *ne = m_routingTable.FindRoute (toDst->GetNextHop ());
+    if (ne == 0)
+    {
+        return;
+    }
+    entry.route = toDst->GetRoute ();
+    entry.nextHopRoute = ne->GetRoute ();
+}
+
+void
+RoutingProtocol::InvalidateForwardingCache ()
+{
+    for (uint32_t i = 0; i < FWD_SLOTS; i++)
+    {
+        m_forwardingCache[i].dst = Ipv4Address ();
+        m_forwardingCache[i].route = 0;
+        m_forwardingCache[i].nextHopRoute = 0;
+    }
+}
+
+void
+RoutingProtocol::RouteRemoved (Ipv4Address dst)
+{
+    for (uint32_t i = 0; i < FWD_SLOTS; i++)
+    {
+        ForwardingCacheEntry &entry = m_forwardingCache[i];
+        // Entry holds the route to its destination and the route to the gateway of that
+        if (entry.route && (entry.dst == dst || entry.route->GetGateway () == dst))
+        {
+            NS_LOG_DEBUG ("Route to " << dst << " removed, drop cached route to " << entry.dst);
+            entry.dst = Ipv4Address ();
+            entry.route = 0;
+            entry.nextHopRoute = 0;
+        }
+    }
+}
+
+const RoutingProtocol::ForwardingCacheEntry*
+RoutingProtocol::FindForwardingCache (Ipv4Address dst) const
+{
+    for (uint32_t i = 0; i < FWD_SLOTS; i++)
+    {
+        if (m_forwardingCache[i].route && m_forwardingCache[i].dst == dst)
+        {
+            return &m_forwardingCache[i];
+        }
+    }
+    return 0;
+}
+
+void
+RoutingProtocol::RebuildInterfaceIndex ()
 {
+    m_interfaceIndex.clear ();
+    m_localAddressIndex.clear ();
+    // Loopback routes carry local source addresses
+    m_loopbackRoutes.clear ();
     for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin (); 
             j != m_socketAddress.end (); ++j)
     {
-        Ptr<Socket> socket = j->first;
-        Ipv4Address iface = j->second.GetLocal();
-        if (iface == addr)
+        m_localAddressIndex[j->second.GetLocal ()] = j->first;
+        int32_t interface = m_ipv4->GetInterfaceForAddress (j->second.GetLocal ());
+        if (interface < 0)
         {
-            return socket;
+            continue;
         }
+        if (static_cast<uint32_t>(interface) >= m_interfaceIndex.size ())
+        {
+            m_interfaceIndex.resize (interface + 1);
+        }
+        LocalInterface &iface = m_interfaceIndex[interface];
+        iface.socket = j->first;
+        iface.local = j->second.GetLocal ();
+        iface.broadcast = j->second.GetBroadcast ();
     }
-  return NULL;
+}
+
+Ptr<Socket>
+RoutingProtocol::FindSocketWithAddress (Ipv4Address addr) const
+{
+    std::map<Ipv4Address, Ptr<Socket> >::const_iterator j = m_localAddressIndex.find (addr);
+    if (j == m_localAddressIndex.end ())
+    {
+        return NULL;
+    }
+    return j->second;
 }
 
 Ptr<Socket>
 RoutingProtocol::FindSocketWithInterfaceAddress (Ipv4InterfaceAddress addr) const
 {
-    for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin (); 
-            j != m_socketAddress.end (); ++j)
+    Ptr<Socket> socket = FindSocketWithAddress (addr.GetLocal ());
+    if (socket)
     {
-        Ptr<Socket> socket = j->first;
-        Ipv4InterfaceAddress iface = j->second;
-        if (iface == addr)
+        std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.find (socket);
+        if (j != m_socketAddress.end () && j->second == addr)
         {
             return socket;
         }
@@ -807,6 +1122,29 @@ RoutingProtocol::Drop (Ptr<const Packet> packet,
                                 << header.GetDestination () << " from queue. Error " << err);
 }
 
+void
+RoutingProtocol::QueueDrop (QueueEntry const &entry, QueueDropReason reason)
+{
+    NS_LOG_DEBUG (m_mainAddress << " drop queued packet " << entry.GetPacket ()->GetUid ()
+                                << ", deadline " << entry.GetDeadline () << ", reason " << reason);
+    m_dropped++;
+    if (reason == QUEUE_DROP_EXPIRED)
+    {
+        m_droppedExpired++;
+    }
+    else
+    {
+        m_droppedOverflow++;
+    }
+}
+
+// Source named by a record, fallback for records that do not name one
+static Ipv4Address
+RecordSource (LeachHeader const &header, Ipv4Address fallback)
+{
+    return (header.GetSource() == Ipv4Address::GetAny()) ? fallback : header.GetSource();
+}
+
 void
 RoutingProtocol::EnqueuePacket (Ptr<Packet> p,
                                 const Ipv4Header & header)
@@ -814,266 +1152,291 @@ RoutingProtocol::EnqueuePacket (Ptr<Packet> p,
     NS_LOG_FUNCTION (this << ", " << p << ", " << header);
     NS_ASSERT (p != 0 && p != Ptr<Packet> ());
     
-    Ptr<Packet> out;
     UdpHeader uhdr;
     LeachHeader leachHeader;
-    uint32_t slot = p->GetUid()%1021;
-    struct hash* now = m_hash[slot];
+    LeachDataTag carrier;
+    uint64_t uid = p->GetUid();
     
     NS_LOG_DEBUG("IsDontFragement: " << header.IsDontFragment());
-  
-    if(header.GetFragmentOffset() == 0) p->RemoveHeader(uhdr);
 
-    while (now != NULL)
+    // Fragments are matched by offset, only the first one starts with headers that can be checked
+    uint32_t offset = header.GetFragmentOffset();
+    uint32_t nextOffset = offset + p->GetSize();
+    Ptr<Packet> partial = m_reassembly.Take(uid, offset);
+    if(offset == 0)
     {
-        if(now->uid == p->GetUid())
-            break;
-        now = now->next;
+        p->RemoveHeader(uhdr);
+        m_dataSourcePort = uhdr.GetSourcePort();
+        m_dataDestinationPort = uhdr.GetDestinationPort();
     }
-    if(now != NULL)
+    else if(partial == 0)
     {
-        NS_LOG_DEBUG("now->p size " << now->p->GetSize() << ", p size " << p->GetSize());
-        now->p->AddAtEnd(p);
-        p = now->p;
+        NS_LOG_DEBUG("Fragment at " << offset << " of packet " << uid << " continues nothing stored, drop");
+        return;
+    }
+    else
+    {
+        NS_LOG_DEBUG("partial size " << partial->GetSize() << ", p size " << p->GetSize());
+        partial->AddAtEnd(p);
+        p = partial;
         NS_LOG_DEBUG("after p size " << p->GetSize());
     }
-  
-    while(DeAggregate(p, out, leachHeader))
+
+    m_recordReader.Reset(p);
+    if(!m_recordReader.IsValid())
     {
-        QueueEntry newEntry (out,header);
-        bool result = m_queue.Enqueue (newEntry);
+        NS_LOG_DEBUG("Packet " << uid << " is not an aggregate, drop");
+        return;
+    }
+    bool tagged = p->PeekPacketTag(carrier);
+    while(m_recordReader.Next(leachHeader))
+    {
+        NS_LOG_DEBUG("deadline" << leachHeader.GetDeadline());
         struct msmt temp;
 
         temp.begin = Simulator::Now();
         temp.end = leachHeader.GetDeadline();
         timeline.push_back(temp);
+        if (leachHeader.GetDeadline() < Now())
+        {
+            // Queue would drop it right away, do not cut it out
+            m_dropped++;
+            m_droppedExpired++;
+            continue;
+        }
+        Ipv4Address source = RecordSource(leachHeader, header.GetSource());
+        if (!AdmitRecord(source))
+        {
+            continue;
+        }
+        // Record shares the bytes of p, deadline was read in place
+        Ptr<Packet> out = p->CreateFragment(m_recordReader.GetRecordOffset(), m_recordReader.GetRecordSize());
+        if (tagged)
+        {
+            // Fragment inherits the tag of the whole aggregate, narrow it to the record
+            LeachDataTag tag (source, leachHeader.GetSequence(), leachHeader.GetDeadline(), carrier.GetGenerated());
+            out->ReplacePacketTag(tag);
+        }
+        QueueEntry newEntry (out, header, leachHeader, source);
+        LeachReadingHeader reading;
+        if (m_recordReader.GetReading(reading))
+        {
+            newEntry.SetReading(reading);
+        }
+        bool result = m_queue.Enqueue (newEntry);
         if (result)
         {
+            m_arrivalRate.Notify();
             NS_LOG_DEBUG ("Added packet " << out->GetUid () << " to queue.");
         }
     }
+    // Keep the incomplete tail until the rest of the packet arrives, even if no byte of it did yet
+    if(m_recordReader.HasPendingRecords() && !header.IsLastFragment())
+    {
+        Ptr<Packet> tail = p->CreateFragment(m_recordReader.GetConsumed(), m_recordReader.GetRemaining());
+        tail->AddHeader(m_recordReader.GetRemainingHeader());
+        m_reassembly.Store(uid, tail, nextOffset);
+    }
 }
 
-bool
-RoutingProtocol::DeAggregate (Ptr<Packet> in, Ptr<Packet>& out, LeachHeader& lhdr)
+uint32_t
+RoutingProtocol::MergeQueued (Ptr<Packet> p, Ipv4Address dst)
 {
-    if(in->GetSize() >= 56)
+    std::vector<QueueEntry> entries;
+    uint32_t count = m_queue.DequeueAll(dst, entries);
+    // Tag of p covers the queued records too, records are not read for it
+    LeachDataTag tag;
+    if (count > 0 && p->PeekPacketTag(tag))
     {
-        LeachHeader leachHeader;
-        in->RemoveHeader(leachHeader);
-        in->RemoveAtStart(16);
-
-        lhdr = leachHeader;
-        out = new Packet(16);
-        out->AddHeader(leachHeader);
-        NS_LOG_DEBUG("deadline" << leachHeader.GetDeadline());
-        return true;
+        for (std::vector<QueueEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+        {
+            LeachDataTag queued (i->GetSource(), 0, i->GetDeadline(), tag.GetGenerated());
+            i->GetPacket()->PeekPacketTag(queued);
+            tag.Merge(queued);
+        }
+        p->ReplacePacketTag(tag);
     }
-    uint32_t slot = in->GetUid()%1021;
-    struct hash* now = m_hash[slot];
-    while(now != NULL)
+    if (m_aggregateFunction != 0)
     {
-        if(now->uid == in->GetUid()) break;
-        now = now->next;
+        Summarize(p, entries);
+        return count;
     }
-    if(now == NULL) 
+    uint32_t size = 0;
+    for (std::vector<QueueEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
     {
-        now = new struct hash;
-        now->uid = in->GetUid();
-        now->next = m_hash[slot];
-        m_hash[slot] = now;
+        size += i->GetPacket()->GetSize();
     }
-    now->p = in;
-    NS_LOG_DEBUG("Size left " << in->GetSize() << ", on UID " << in->GetUid());
-  
-    return false;
+    if (size == 0)
+    {
+        return count;
+    }
+    // Records of p stay first, queued records are listed after them
+    LeachAggregateHeader aggregate;
+    p->RemoveHeader(aggregate);
+    NS_ASSERT (aggregate.IsValid());
+    // Copy all chunks into one buffer, appending chunks one by one reallocates p every time
+    std::vector<uint8_t> buffer (size);
+    uint32_t offset = 0;
+    for (std::vector<QueueEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+    {
+        aggregate.AddRecord(i->GetPacket()->GetSize());
+        offset += i->GetPacket()->CopyData(&buffer[offset], size - offset);
+    }
+    p->AddAtEnd(Create<Packet> (&buffer[0], size));
+    p->AddHeader(aggregate);
+    return count;
 }
 
-bool
-RoutingProtocol::DataAggregation (Ptr<Packet> p)
+static bool
+ArrivedBefore (QueueEntry const &a, QueueEntry const &b)
 {
-    // Implement data aggregation policy
-    // and data addgregation function
-
-#ifdef DA_PROP 
-    return Proposal(p);
-#endif
-#ifdef DA_OPT
-    return OptTM(p);
-#endif
-#ifdef DA_CL
-    return ControlLimit(p);
-#endif
-#ifdef DA_SF
-    return SelectiveForwarding(p);
-#endif
-  
-  return true;
+    return a.GetSequence() < b.GetSequence();
 }
 
-bool
-RoutingProtocol::Proposal (Ptr<Packet> p)
+void
+RoutingProtocol::Summarize (Ptr<Packet> p, std::vector<QueueEntry> &entries)
 {
-  NS_LOG_FUNCTION (this);
-  // pick up those selected entry and send
-  int expired = 0, expected;
-  //LeachHeader hdr;
-  Time deadLine = Now();
-  
-  // 1.28 = 2*0.64, 0.064 = 64bytes/8kbps
-  // average 10 cluster heads
-  // average 10 members per cluster
-  deadLine += Seconds(m_queue.GetSize()/m_lambda);
-  if(!clusterHeadThisRound)
-    // depend on average tx size from cluster member
-    // depend on deadline setting
-    // * average packet_size?
-    deadLine += Seconds(0.064+1.0/m_lambda);
-
-//  NS_LOG_UNCOND("Now: " << Now() << ", Deadline: " << deadLine);
-  for (int i=0; i<(int)m_queue.GetSize(); i++)
-    {
-      NS_LOG_DEBUG("GetDeadline: " << m_queue[i].GetDeadline() << ", UID: " << m_queue[i].GetPacket()->GetUid() << ", Now: " << Now());
-      if(m_queue[i].GetDeadline() < Now())
+    LeachHeader leachHeader;
+    LeachReadingHeader reading;
+    LeachAggregateHeader aggregate;
+    // Records that cannot be folded are sent as they are, after the summary
+    std::vector<Ptr<Packet> > kept;
+    std::vector<SummaryRecord> summary;
+
+    // Queue is sorted by deadline, fold in arrival order and records of p last.
+    // Queued records were read at enqueue, their stored headers are folded.
+    std::sort(entries.begin(), entries.end(), ArrivedBefore);
+    for (std::vector<QueueEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+    {
+        if (!i->GetReading(reading)
+            || !m_aggregateFunction->Add(i->GetSource(), i->GetRecordHeader(), reading))
         {
-          // drop it
-          NS_LOG_DEBUG("Drop");
-//          NS_LOG_DEBUG("GetLeachHeader: " << m_queue[i].GetDeadline() << ", Now: " << Now());
-          m_queue.Drop (i);
-          m_dropped++;
-          i--;
+            kept.push_back(i->GetPacket());
         }
     }
-  
-  for(uint32_t i=0; i<m_queue.GetSize(); i++) {
-//    NS_LOG_UNCOND("GetDeadline: " << m_queue[i].GetDeadline() << ", deadline: " << deadLine);
-    if(m_queue[i].GetDeadline() < deadLine) {
-      expired++;
-    }
-  }
-  if(clusterHeadThisRound) {
-    expected = 1+m_clusterMember.size();
-  }
-  else {
-    expected = 1;
-  }
-  
-//  NS_LOG_UNCOND("expired: " << expired << ", expected: " << expected);
-  if(expired >= expected || Now() > Seconds(48.5)) {
-    // merge data
-    QueueEntry temp;
-    
-    while(m_queue.Dequeue(m_sinkAddress, temp)) {
-      p->AddAtEnd(temp.GetPacket());
-    }
-    
-    return true;
-  }
-  return false;
-}
-
-bool
-RoutingProtocol::OptTM (Ptr<Packet> p)
-{
-    Time time = Now();
-    uint32_t rewards[100], maxR = 0;
-    uint32_t actions[100];
-    static int step = 0;
-
-    for(int i=0; i<100; i++)
+    m_recordReader.Reset(p);
+    while(m_recordReader.Next(leachHeader))
     {
-        actions[i] = 0;
-        rewards[i] = 0;
-        for(uint j=0; j<m_queue.GetSize(); j++)
+        if (!m_recordReader.GetReading(reading)
+            || !m_aggregateFunction->Add(RecordSource(leachHeader, m_mainAddress), leachHeader, reading))
         {
-            if(m_queue[j].GetDeadline() >= time) rewards[i] += m_queue[j].GetDeadline().ToInteger(Time::MS) - time.ToInteger(Time::MS);
+            kept.push_back(p->CreateFragment(m_recordReader.GetRecordOffset(), m_recordReader.GetRecordSize()));
         }
-        for(int j=1; j<i+step; j++)
-        {
-            rewards[i] += (j<8) ?30000-j*4000 :0;
-        }
-        time += Seconds(1/m_lambda);
     }
-  
-    for(int i=0; i<100; i++)
+    m_aggregateFunction->Flush(summary);
+
+    p->RemoveAtEnd(p->GetSize());
+    for (std::vector<SummaryRecord>::const_iterator i = summary.begin(); i != summary.end(); ++i)
     {
-        if(rewards[i] > maxR)
-        {
-            maxR = rewards[i];
-        }
+        Ptr<Packet> record = Create<Packet> ();
+        record->AddHeader(i->reading);
+        record->AddHeader(i->header);
+        aggregate.AddRecord(record->GetSize());
+        p->AddAtEnd(record);
     }
-  
-    // wait=1, transmit=2
-    for(int i=98; i>=0; i--)
+    for (std::vector<Ptr<Packet> >::const_iterator i = kept.begin(); i != kept.end(); ++i)
     {
-        if(rewards[i] < maxR)
-            actions[i] = 1;
-        else
-        {
-            double rb[100], rn[100];
-            rb[99] = 1.0;
-            rn[99] = 0.0;
+        aggregate.AddRecord((*i)->GetSize());
+        p->AddAtEnd(*i);
+    }
+    p->AddHeader(aggregate);
+    NS_LOG_DEBUG("Summarized " << entries.size() << " queued records into " << aggregate.GetRecordCount() << " records");
+}
 
-            for(int k=98; k>i; k--)
-            {
-                rn[k] = max(0.0, i*rn[k+1]/(k+1) + rb[k+1]/(k+1));
-                rb[k] = max(rewards[k], rn[k]);
-            }
+bool
+RoutingProtocol::AdmitRecord (Ipv4Address source)
+{
+    LeachReadingHeader reading;
+    if (!m_recordReader.GetReading(reading) || m_aggregationPolicy->Admit(source, reading.GetValue()))
+    {
+        return true;
+    }
+    m_suppressed++;
+    return false;
+}
 
-            if(rewards[i] >= (uint32_t)rb[i+1])
-                actions[i] = 2;
-            else
-                actions[i] = 1;
+uint32_t
+RoutingProtocol::FilterAggregate (Ptr<Packet> p, Ipv4Address source)
+{
+    LeachHeader leachHeader;
+    LeachAggregateHeader aggregate;
+    std::vector<Ptr<Packet> > records;
+    bool suppressed = false;
+
+    m_recordReader.Reset(p);
+    while(m_recordReader.Next(leachHeader))
+    {
+        if (!AdmitRecord(RecordSource(leachHeader, source)))
+        {
+            suppressed = true;
+            continue;
         }
+        aggregate.AddRecord(m_recordReader.GetRecordSize());
+        records.push_back(p->CreateFragment(m_recordReader.GetRecordOffset(), m_recordReader.GetRecordSize()));
     }
-    step++;
-  
-    if(actions[0] > 1 || Now() > Seconds(48.5))
+    if (suppressed)
     {
-        QueueEntry temp;
-        while(m_queue.Dequeue(m_sinkAddress, temp))
+        p->RemoveAtEnd(p->GetSize());
+        for (std::vector<Ptr<Packet> >::const_iterator i = records.begin(); i != records.end(); ++i)
         {
-            p->AddAtEnd(temp.GetPacket());
+            p->AddAtEnd(*i);
         }
-      
-        return true;
+        p->AddHeader(aggregate);
     }
-  
-    return false;
+    return aggregate.GetRecordCount();
 }
 
-
 bool
-RoutingProtocol::ControlLimit (Ptr<Packet> p)
+RoutingProtocol::DataAggregation (Ptr<Packet> p)
 {
-    static uint32_t threshold = (1/(log(1/0.1)*(log(1/0.1)+m_lambda)))+2;
-    for(int i=0; i<(int)m_queue.GetSize(); i++)
+    // Implement data aggregation policy
+    // and data addgregation function
+    AggregationState state;
+    m_generationRate.Notify();
+    state.queue = &m_queue;
+    state.sink = m_sinkAddress;
+    state.lambda = m_generationRate.GetRate();
+    state.arrivalRate = m_arrivalRate.GetRate();
+    state.drainRate = m_drainRate.GetRate();
+    state.clusterHead = clusterHeadThisRound;
+    state.clusterMembers = m_clusterMember.size();
+    state.draining = m_draining;
+    state.deadline = Time::Max();
+    // Earliest deadline of p is kept in its tag, records are only read if it is untagged
+    LeachDataTag tag;
+    if (p->PeekPacketTag(tag))
     {
-        if(m_queue[i].GetDeadline() < Now())
+        state.deadline = tag.GetDeadline();
+    }
+    else
+    {
+        LeachHeader leachHeader;
+        m_recordReader.Reset(p);
+        while(m_recordReader.Next(leachHeader))
         {
-            m_queue.Drop(i);
-            m_dropped++;
-            i--;
+            if (leachHeader.GetDeadline() < state.deadline)
+            {
+                state.deadline = leachHeader.GetDeadline();
+            }
         }
     }
-    
-    if(m_queue.GetSize() >= threshold || Now() > Seconds(48.5))
+
+    if (m_aggregationPolicy->ShouldSend(state))
     {
-        QueueEntry temp;
-        while(m_queue.Dequeue(m_sinkAddress, temp)) 
+        // Queued records were offered to the policy when they arrived, records of p were not
+        uint32_t own = FilterAggregate(p, m_mainAddress);
+        if (own == 0 && m_queue.GetCountForPacketsWithDst(m_sinkAddress) == 0)
         {
-            p->AddAtEnd(temp.GetPacket());
+            return false;
         }
+        // Records of p arrive and leave at once, queued ones were counted on arrival
+        m_arrivalRate.Notify(own);
+        // merge data
+        m_drainRate.Notify(own + MergeQueued(p, m_sinkAddress));
         return true;
     }
     return false;
 }
-  
-bool
-RoutingProtocol::SelectiveForwarding (Ptr<Packet> p)
-{
-    return false;
-}
 
 
 } /* namespace leach */
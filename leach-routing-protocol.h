@@ -3,6 +3,10 @@
  
 #include <vector>
 
+#include "leach-aggregate-function.h"
+#include "leach-aggregation-policy.h"
+#include "leach-rate-estimator.h"
+#include "leach-reassembly-table.h"
 #include "leach-routing-queue.h"
 #include "leach-routing-table.h"
 #include "LeachPacket.h"
@@ -149,6 +153,10 @@ public:
         return &timeline;
     }
     std::vector<Time>* getTxTime();
+    /// Number of partially received aggregates held by the node
+    uint32_t GetReassemblyOccupancy () const;
+    /// Number of partially received aggregates released before they were completed
+    uint64_t GetReassemblyEvictions () const;
 
     /**
      * Assign a fixed random variable stream number to the random variables
@@ -174,15 +182,53 @@ private:
     uint32_t clusterHeadThisRound;
     uint32_t isSink;
     TracedValue<uint32_t> m_dropped;
-    // Packet generation rate
+    /// Packets dropped from queue past their deadline
+    TracedValue<uint32_t> m_droppedExpired;
+    /// Packets dropped because queue was full
+    TracedValue<uint32_t> m_droppedOverflow;
+    /// Records suppressed by the aggregation policy
+    TracedValue<uint32_t> m_suppressed;
+    /// Queue bounds, 0 for no limit
+    uint32_t m_maxQueueLen;
+    uint32_t m_maxQueueBytes;
+    /// What a full queue drops
+    QueueDropPolicy m_queueDropPolicy;
+    // Packet generation rate, initial estimate
     double m_lambda;
+    /// Time constant of the rate estimates
+    Time m_rateTimeConstant;
+    /// Own packets, records entering the node and records sent, per second
+    RateEstimator m_generationRate;
+    RateEstimator m_arrivalRate;
+    RateEstimator m_drainRate;
+    /// End of the simulation, 0 if unknown
+    Time m_stopTime;
+    /// Time before m_stopTime at which the node starts sending everything it queued
+    Time m_drainMargin;
+    /// Drain phase started, every packet carries all queued records
+    bool m_draining;
+    /// Interval at which queues are flushed during the drain phase
+    Time m_drainInterval;
+    /// UDP ports of the data packets received, drained aggregates are sent with them
+    uint16_t m_dataSourcePort;
+    uint16_t m_dataDestinationPort;
+    /// Aggregation policy, 0 if packets are not aggregated
+    AggregationPolicyType m_aggregationPolicyType;
+    Ptr<AggregationPolicy> m_aggregationPolicy;
+    /// Selective forwarding thresholds
+    double m_hardThreshold;
+    double m_softThreshold;
+    Time m_maxReportInterval;
+    /// Function folding records into summaries when sending, 0 to concatenate them
+    AggregateFunctionType m_aggregateFunctionType;
+    Ptr<AggregateFunction> m_aggregateFunction;
 
-    struct hash
-    {
-        uint32_t uid;
-        Ptr<Packet> p;
-        struct hash* next;
-    }*m_hash[1021];
+    /// Walks records of received aggregates
+    LeachRecordReader m_recordReader;
+    /// Aggregates whose tail did not arrive yet
+    ReassemblyTable m_reassembly;
+    uint32_t m_reassemblyCapacity;
+    Time m_reassemblyTimeout;
 
     std::vector<struct msmt> timeline;
     std::vector<Time> tx_time;
@@ -204,10 +250,46 @@ private:
     Ptr<Ipv4> m_ipv4;
     /// Raw socket per each IP interface, map socket -> iface address (IP + mask)
     std::map<Ptr<Socket>, Ipv4InterfaceAddress> m_socketAddress;
+    /// LEACH socket and addresses of one IP interface
+    struct LocalInterface
+    {
+        /// Socket listening on the interface, 0 if the interface is not used by LEACH
+        Ptr<Socket> socket;
+        Ipv4Address local;
+        Ipv4Address broadcast;
+    };
+    /// m_socketAddress indexed by interface number, used to classify received packets
+    std::vector<LocalInterface> m_interfaceIndex;
+    /// m_socketAddress indexed by local address, its keys are the set of local addresses
+    std::map<Ipv4Address, Ptr<Socket> > m_localAddressIndex;
     /// Loopback device used to defer route requests until route is found 
     Ptr<NetDevice> m_lo;
     /// Main Routing Table for the node
     RoutingTable m_routingTable;
+    /// Resolved route to one of the destinations a node forwards to in a round
+    struct ForwardingCacheEntry
+    {
+        /// Destination, cluster head or sink
+        Ipv4Address dst;
+        /// Route of the destination entry, as returned by RouteOutput
+        Ptr<Ipv4Route> route;
+        /// Route of the next hop entry, as used by RouteInput to forward
+        Ptr<Ipv4Route> nextHopRoute;
+    };
+    enum ForwardingCacheSlot
+    {
+        FWD_CLUSTER_HEAD = 0,
+        FWD_SINK = 1,
+        FWD_SLOTS = 2,
+    };
+    /// Per-round forwarding cache, filled when routes are installed and cleared every round
+    ForwardingCacheEntry m_forwardingCache[FWD_SLOTS];
+    /// Loopback routes handed out for unrouted packets, keyed by (destination, source).
+    /// The output device of every loopback route is m_lo, so it is not part of the key.
+    typedef std::map<std::pair<Ipv4Address, Ipv4Address>, Ptr<Ipv4Route> > LoopbackRouteCache;
+    mutable LoopbackRouteCache m_loopbackRoutes;
+    /// Bound on m_loopbackRoutes, the cache is flushed when it is reached
+    static const uint32_t MAX_LOOPBACK_ROUTES;
     /// From selecting CHs, best stores here
     RoutingTableEntry m_bestRoute;
     /// Node Position
@@ -230,22 +312,27 @@ private:
     /// Queue Packet till route is found
     void
     EnqueuePacket (Ptr<Packet> p, const Ipv4Header &header);
-    /// Decide wether to send packet in buffer
+    /// Decide wether to send packet in buffer, merges queued packets into p if so
     bool
     DataAggregation (Ptr<Packet> p);
-    bool
-    Proposal (Ptr<Packet> p);
-    bool
-    OptTM (Ptr<Packet> p);
-    bool
-    ControlLimit (Ptr<Packet> p);
-    bool
-    SelectiveForwarding (Ptr<Packet> p);
 
-    /// De-Aggregate chunks of data
+    /// Move all queued packets for dst to the end of p in one step, return number of packets
+    uint32_t
+    MergeQueued (Ptr<Packet> p, Ipv4Address dst);
+    /// Replace records of p and entries by their summary, records that cannot be folded are kept
+    void
+    Summarize (Ptr<Packet> p, std::vector<QueueEntry> &entries);
+    /// Offer last record read by m_recordReader to the policy, false if it is suppressed
     bool
-    DeAggregate (Ptr<Packet> in, Ptr<Packet> &out, LeachHeader&);
+    AdmitRecord (Ipv4Address source);
+    /// Remove records of p suppressed by the policy, return number of records left.
+    /// Records that name no source are taken to come from source.
+    uint32_t
+    FilterAggregate (Ptr<Packet> p, Ipv4Address source);
 
+    /// Rebuild m_interfaceIndex and m_localAddressIndex from m_socketAddress
+    void
+    RebuildInterfaceIndex ();
     /// Find Socket with local interface address iface
     Ptr<Socket>
     FindSocketWithInterfaceAddress (Ipv4InterfaceAddress iface) const;
@@ -260,19 +347,42 @@ private:
 
     void
     Send (Ptr<Ipv4Route>, Ptr<const Packet>, const Ipv4Header&);
+    /// Resolve routes to dst through the routing table and keep them in forwarding cache slot
+    void
+    CacheForwardingRoute (ForwardingCacheSlot slot, Ipv4Address dst);
+    /// Drop all forwarding cache entries
+    void
+    InvalidateForwardingCache ();
+    /// Drop forwarding cache entries resolved through the route to dst, called by the routing table
+    void
+    RouteRemoved (Ipv4Address dst);
+    /// Forwarding cache entry for dst, or 0 on miss
+    const ForwardingCacheEntry*
+    FindForwardingCache (Ipv4Address dst) const;
     /// Create Loopback Route for given header
     Ptr<Ipv4Route>
     LoopbackRoute (const Ipv4Header &header, Ptr<NetDevice> oif) const;
+    /// Shared loopback route from src to dst, must not be modified by the caller
+    Ptr<Ipv4Route>
+    GetLoopbackRoute (Ipv4Address dst, Ipv4Address src) const;
     /// Triggered by timer, sent 1s after cluster head is elected
     void
     SendBroadcast();
+    /// Fraction of energy left in the first energy source of the node, 1 if there is none
+    double
+    GetEnergyFraction () const;
     /// Select cluster head selection
     void
     PeriodicUpdate();
     /// Cluster members tell cluster head 
     void 
     RespondToClusterHead ();
-#ifndef DA
+    /// Triggered by timer from DrainMargin before StopTime, every DrainInterval, flushes all queues
+    void
+    Drain ();
+    /// Send all records queued for dst in one aggregate, false if there is no route to dst
+    bool
+    FlushQueued (Ipv4Address dst);
     /// Deal with no DA
     void
     EnqueueForNoDA (UnicastForwardCallback ucb, Ptr<Ipv4Route> route, Ptr<const Packet> p, const Ipv4Header &header);
@@ -286,11 +396,13 @@ private:
         Ipv4Header header;
     };
     std::vector<struct DeferredPack> DeferredQueue;
-#endif
 
     /// Notify if packet is dropped
     void 
     Drop (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno);
+    /// Count packet dropped by queue
+    void
+    QueueDrop (QueueEntry const &entry, QueueDropReason reason);
 
     /// Timer to trigger periodic updates 
     Timer m_periodicUpdateTimer;
@@ -298,6 +410,8 @@ private:
     Timer m_broadcastClusterHeadTimer;
     /// Timer to feed cluster head its members
     Timer m_respondToClusterHeadTimer;
+    /// Timer to flush queues in the drain phase
+    Timer m_drainTimer;
     /// Provide uniform random variables
     Ptr<UniformRandomVariable> m_uniformRandomVariable;
 };
@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <bits/stdint-uintn.h>
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <map>
 #include <vector>
 
 #include "leach-routing-queue.h"
@@ -15,10 +18,15 @@ NS_LOG_COMPONENT_DEFINE("LeachPacketQueue");
 
 namespace leach {
 
+PacketQueue::~PacketQueue()
+{
+    m_expiryEvent.Cancel();
+}
+
 uint32_t
-PacketQueue::GetSize()
+PacketQueue::GetSize() const
 {
-    return m_queue.size();
+    return m_size;
 }
 
 bool
@@ -27,7 +35,30 @@ PacketQueue::Enqueue(QueueEntry &entry)
     try 
     {
         NS_LOG_FUNCTION("Enqueing packet destined for " << entry.GetIpv4Header().GetDestination());
-        m_queue.push_back(entry);
+        if (!MakeRoom(entry))
+        {
+            NS_LOG_DEBUG("Queue full, drop arriving packet " << entry.GetPacket()->GetUid());
+            if (!m_dropCallback.IsNull())
+            {
+                m_dropCallback(entry, QUEUE_DROP_OVERFLOW);
+            }
+            return false;
+        }
+        entry.SetSequence(m_sequence++);
+        Bucket &bucket = m_buckets[entry.GetIpv4Header().GetDestination()];
+        if (bucket.empty() || !(entry.GetDeadline() < bucket.back().GetDeadline()))
+        {
+            bucket.push_back(entry);
+        }
+        else
+        {
+            // Keep arrival order among entries with equal deadline
+            bucket.insert(std::upper_bound(bucket.begin(), bucket.end(), entry.GetDeadline(), IsAfter), entry);
+        }
+        m_size++;
+        m_bytes += entry.GetPacket()->GetSize();
+        m_version++;
+        ScheduleExpiry();
         return true;
     }
     catch(...) 
@@ -37,56 +68,255 @@ PacketQueue::Enqueue(QueueEntry &entry)
     }
 }
 
+bool
+PacketQueue::IsFull(uint32_t size) const
+{
+    return (m_maxLen != 0 && m_size + 1 > m_maxLen)
+        || (m_maxBytes != 0 && m_bytes + size > m_maxBytes);
+}
+
 void
-PacketQueue::Drop(uint32_t idx)
+PacketQueue::DropAt(std::map<Ipv4Address, Bucket>::iterator b, Bucket::iterator i, QueueDropReason reason)
 {
-    m_queue.erase(m_queue.begin()+idx);
+    NS_LOG_DEBUG("Drop packet " << i->GetPacket()->GetUid() << ", deadline " << i->GetDeadline() << ", reason " << reason);
+    QueueEntry entry = *i;
+    b->second.erase(i);
+    if (b->second.empty())
+    {
+        m_buckets.erase(b);
+    }
+    m_size--;
+    m_bytes -= entry.GetPacket()->GetSize();
+    m_version++;
+    if (!m_dropCallback.IsNull())
+    {
+        m_dropCallback(entry, reason);
+    }
 }
 
 bool
-PacketQueue::Dequeue(Ipv4Address dst, QueueEntry &entry)
+PacketQueue::MakeRoom(QueueEntry const &entry)
 {
-    NS_LOG_FUNCTION("Dequeueing packet destined for " << dst);
-    for (std::vector<QueueEntry>::iterator i = m_queue.begin(); i != m_queue.end(); ++i)
+    uint32_t size = entry.GetPacket()->GetSize();
+    if (!IsFull(size))
     {
-        if (i->GetIpv4Header().GetDestination() == dst)
+        return true;
+    }
+    if (m_maxBytes != 0 && size > m_maxBytes)
+    {
+        // Would not fit in an empty queue, do not evict anything for it
+        return false;
+    }
+    if (m_dropPolicy == DROP_EXPIRED_FIRST)
+    {
+        DropExpired(Simulator::Now());
+    }
+    while (IsFull(size))
+    {
+        if (m_buckets.empty() || m_dropPolicy == DROP_TAIL || m_dropPolicy == DROP_EXPIRED_FIRST)
+        {
+            return false;
+        }
+        std::map<Ipv4Address, Bucket>::iterator victimBucket = m_buckets.begin();
+        Bucket::iterator victim = victimBucket->second.begin();
+        if (m_dropPolicy == DROP_HEAD)
         {
-            entry = *i;
-            m_queue.erase(i);
-            return true;
+            // Only scanned when the queue overflows, and then it holds at most MaxLen entries
+            for (std::map<Ipv4Address, Bucket>::iterator b = m_buckets.begin(); b != m_buckets.end(); ++b)
+            {
+                for (Bucket::iterator i = b->second.begin(); i != b->second.end(); ++i)
+                {
+                    if (i->GetSequence() < victim->GetSequence())
+                    {
+                        victimBucket = b;
+                        victim = i;
+                    }
+                }
+            }
         }
+        else
+        {
+            // Earliest deadline is at the front of one of the buckets
+            for (std::map<Ipv4Address, Bucket>::iterator b = m_buckets.begin(); b != m_buckets.end(); ++b)
+            {
+                if (b->second.front().GetDeadline() < victim->GetDeadline())
+                {
+                    victimBucket = b;
+                    victim = b->second.begin();
+                }
+            }
+            if (entry.GetDeadline() < victim->GetDeadline())
+            {
+                return false;
+            }
+        }
+        DropAt(victimBucket, victim, QUEUE_DROP_OVERFLOW);
     }
-    return false; 
+    return true;
 }
 
-bool
-PacketQueue::Find(Ipv4Address dst)
+uint32_t
+PacketQueue::DropExpired(Time t)
 {
-    for (std::vector<QueueEntry>::iterator i = m_queue.begin(); i!= m_queue.end(); ++i)
+    uint32_t count = 0;
+    std::map<Ipv4Address, Bucket>::iterator i = m_buckets.begin();
+    while (i != m_buckets.end())
     {
-        if (i->GetIpv4Header().GetDestination() == dst)
+        std::map<Ipv4Address, Bucket>::iterator b = i++;
+        // DropAt erases b once it is empty
+        uint32_t left = b->second.size();
+        while (left > 0 && b->second.front().GetDeadline() < t)
         {
-            NS_LOG_DEBUG("Found");
-            return true;
+            DropAt(b, b->second.begin(), QUEUE_DROP_EXPIRED);
+            left--;
+            count++;
         }
     }
-    return false;
+    return count;
+}
+
+void
+PacketQueue::Clear()
+{
+    m_buckets.clear();
+    m_size = 0;
+    m_bytes = 0;
+    m_version++;
+    m_expiryEvent.Cancel();
+}
+
+Time
+PacketQueue::GetEarliestDeadline() const
+{
+    NS_ASSERT(!m_buckets.empty());
+    std::map<Ipv4Address, Bucket>::const_iterator i = m_buckets.begin();
+    Time earliest = i->second.front().GetDeadline();
+    for (++i; i != m_buckets.end(); ++i)
+    {
+        if (i->second.front().GetDeadline() < earliest)
+        {
+            earliest = i->second.front().GetDeadline();
+        }
+    }
+    return earliest;
+}
+
+void
+PacketQueue::ScheduleExpiry()
+{
+    if (m_buckets.empty())
+    {
+        return;
+    }
+    // Entry expires once its deadline is in the past, one time step after it
+    Time t = GetEarliestDeadline() + TimeStep(1);
+    if (m_expiryEvent.IsRunning() && !(t < m_expiryTime))
+    {
+        return;
+    }
+    m_expiryEvent.Cancel();
+    m_expiryTime = t;
+    Time delay = (t > Simulator::Now()) ? t - Simulator::Now() : Time(0);
+    m_expiryEvent = Simulator::Schedule(delay, &PacketQueue::Expire, this);
+}
+
+void
+PacketQueue::Expire()
+{
+    DropExpired(Simulator::Now());
+    ScheduleExpiry();
 }
 
 uint32_t
-PacketQueue::GetCountForPacketsWithDst(Ipv4Address dst)
+PacketQueue::GetCountBefore(Time t) const
 {
     uint32_t count = 0;
-    for (std::vector<QueueEntry>::iterator i = m_queue.begin(); i != m_queue.end(); ++i)
+    for (std::map<Ipv4Address, Bucket>::const_iterator i = m_buckets.begin(); i != m_buckets.end(); ++i)
+    {
+        count += std::lower_bound(i->second.begin(), i->second.end(), t, IsBefore) - i->second.begin();
+    }
+    return count;
+}
+
+void
+PacketQueue::GetDeadlines(std::vector<Time> &deadlines) const
+{
+    for (std::map<Ipv4Address, Bucket>::const_iterator i = m_buckets.begin(); i != m_buckets.end(); ++i)
     {
-        if (i->GetIpv4Header().GetDestination() == dst)
+        for (Bucket::const_iterator j = i->second.begin(); j != i->second.end(); ++j)
         {
-            count++;
+            deadlines.push_back(j->GetDeadline());
         }
     }
+}
+
+void
+PacketQueue::GetDestinations(std::vector<Ipv4Address> &destinations) const
+{
+    for (std::map<Ipv4Address, Bucket>::const_iterator i = m_buckets.begin(); i != m_buckets.end(); ++i)
+    {
+        if (!i->second.empty())
+        {
+            destinations.push_back(i->first);
+        }
+    }
+}
+
+bool
+PacketQueue::Dequeue(Ipv4Address dst, QueueEntry &entry)
+{
+    NS_LOG_FUNCTION("Dequeueing packet destined for " << dst);
+    std::map<Ipv4Address, Bucket>::iterator i = m_buckets.find(dst);
+    if (i == m_buckets.end())
+    {
+        return false;
+    }
+    entry = i->second.front();
+    i->second.pop_front();
+    if (i->second.empty())
+    {
+        m_buckets.erase(i);
+    }
+    m_size--;
+    m_bytes -= entry.GetPacket()->GetSize();
+    m_version++;
+    return true;
+}
+
+uint32_t
+PacketQueue::DequeueAll(Ipv4Address dst, std::vector<QueueEntry> &out)
+{
+    NS_LOG_FUNCTION("Dequeueing all packets destined for " << dst);
+    std::map<Ipv4Address, Bucket>::iterator i = m_buckets.find(dst);
+    if (i == m_buckets.end())
+    {
+        return 0;
+    }
+    uint32_t count = i->second.size();
+    for (Bucket::const_iterator j = i->second.begin(); j != i->second.end(); ++j)
+    {
+        m_bytes -= j->GetPacket()->GetSize();
+    }
+    out.insert(out.end(), std::make_move_iterator(i->second.begin()), std::make_move_iterator(i->second.end()));
+    m_buckets.erase(i);
+    m_size -= count;
+    m_version++;
     return count;
 }
 
+bool
+PacketQueue::Find(Ipv4Address dst) const
+{
+    return m_buckets.find(dst) != m_buckets.end();
+}
+
+uint32_t
+PacketQueue::GetCountForPacketsWithDst(Ipv4Address dst) const
+{
+    std::map<Ipv4Address, Bucket>::const_iterator i = m_buckets.find(dst);
+    return (i == m_buckets.end()) ? 0 : i->second.size();
+}
+
 } /* namespace leach */
 } /* namespace ns3 */
 
@@ -2,7 +2,11 @@
 #define LEACH_ROUTING_QUEUE_H
 
 #include <cstddef>
+#include <deque>
+#include <map>
 #include <vector>
+#include "ns3/callback.h"
+#include "ns3/event-id.h"
 #include "ns3/ipv4-header.h"
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/nstime.h"
@@ -16,6 +20,22 @@
 namespace ns3 {
 namespace leach {
 
+/// What a full queue drops to make room
+enum QueueDropPolicy
+{
+    DROP_TAIL = 0,              ///< Drop the arriving entry
+    DROP_HEAD = 1,              ///< Drop the entry queued the longest
+    DROP_EARLIEST_DEADLINE = 2, ///< Drop the entry closest to its deadline
+    DROP_EXPIRED_FIRST = 3,     ///< Drop expired entries, then the arriving entry
+};
+
+/// Why an entry was dropped from the queue
+enum QueueDropReason
+{
+    QUEUE_DROP_EXPIRED = 0,
+    QUEUE_DROP_OVERFLOW = 1,
+};
+
 /**
  * \ingroup leach
  * \brief LEACH queue entry
@@ -25,18 +45,21 @@ class QueueEntry
 public:
     typedef Ipv4RoutingProtocol::UnicastForwardCallback UnicastForwardCallback;
 
-    // Constructor
-    QueueEntry (Ptr<Packet> packet=0, Ipv4Header const &h = Ipv4Header())
+    QueueEntry ()
+        : m_sequence (0),
+          m_hasReading (false)
+    {
+    }
+    // Constructor for a record whose header and source are already known, packet is not read
+    QueueEntry (Ptr<Packet> packet, Ipv4Header const &h, LeachHeader const &record, Ipv4Address source)
         : m_packet (packet),
-          m_header (h)
+          m_header (h),
+          m_deadline (record.GetDeadline()),
+          m_source (source),
+          m_sequence (0),
+          m_record (record),
+          m_hasReading (false)
     {
-        if (packet != 0)
-        {
-            Packet a (*packet);
-            LeachHeader leachHeader;
-            a.RemoveHeader(leachHeader);
-            m_deadline = leachHeader.GetDeadline();
-        }
     }
 
     /**
@@ -56,6 +79,18 @@ public:
     void SetIpv4Header(Ipv4Header header) { m_header = header;}
     Time GetDeadline() const {return m_deadline;}
     void SetDeadline(Time deadline) {m_deadline = deadline;}
+    Ipv4Address GetSource() const {return m_source;}
+    void SetSource(Ipv4Address source) {m_source = source;}
+    uint64_t GetSequence() const {return m_sequence;}
+    void SetSequence(uint64_t sequence) {m_sequence = sequence;}
+    LeachHeader GetRecordHeader() const {return m_record;}
+    // Reading of the record, false if it was not known at enqueue
+    bool GetReading(LeachReadingHeader &reading) const
+    {
+        reading = m_reading;
+        return m_hasReading;
+    }
+    void SetReading(LeachReadingHeader const &reading) {m_reading = reading; m_hasReading = true;}
 
 private:
     // Data Packet
@@ -64,6 +99,15 @@ private:
     Ipv4Header m_header;
     // Deadline
     Time m_deadline;
+    // Node the packet was received from
+    Ipv4Address m_source;
+    // Arrival order in queue
+    uint64_t m_sequence;
+    // Record header, kept so the record is not parsed again
+    LeachHeader m_record;
+    // Reading of the record, valid if m_hasReading
+    LeachReadingHeader m_reading;
+    bool m_hasReading;
 };
 
 
@@ -71,43 +115,123 @@ private:
  * \ingroup leach
  * \brief LEACH packet queue
  *
- * When route is not available, packets are queued. Every node can buffer upto 5 packets
- * per destination. We will drop the first queued packet if the buffer is full.
+ * When route is not available, packets are queued. Entries are kept in one
+ * bucket per destination, each sorted by deadline, earliest first, so expired
+ * entries are popped from the bucket fronts, entries due before a given time
+ * are counted with a binary search and all entries for a destination are
+ * taken out in one pass. Entries mostly arrive in deadline order and are then
+ * appended at the back of their bucket.
+ *
+ * Queue can be bounded in number of entries and in bytes, an entry that does
+ * not fit makes room according to the drop policy. Every dropped entry is
+ * reported to the drop callback.
+ *
+ * Expired entries are dropped by a single event scheduled just after the
+ * earliest queued deadline. The event is moved earlier when an entry with an
+ * earlier deadline arrives, and it is left in place when entries leave, if it
+ * fires with nothing to drop it is re-armed for the new earliest deadline.
  */
 class PacketQueue
 {
 public:
+    typedef Callback<void, QueueEntry const &, QueueDropReason> DropCallback;
+
     PacketQueue()
+        : m_size (0),
+          m_bytes (0),
+          m_sequence (0),
+          m_version (0),
+          m_maxLen (0),
+          m_maxBytes (0),
+          m_dropPolicy (DROP_TAIL)
     {
     }
+    ~PacketQueue();
     
-    /// Push entry in queue, if there is no entry with same packet and destination address in queue
+    /// Insert entry into the bucket of its destination by deadline, after entries with an equal deadline.
+    /// A full queue first makes room by the drop policy, false if entry itself is dropped.
     bool Enqueue (QueueEntry &entry);
     /// Return earliest entry for given destination
     bool Dequeue (Ipv4Address dst, QueueEntry &entry);
+    /// Move all entries for given destination to the end of out, earliest first, return number of entries
+    uint32_t DequeueAll (Ipv4Address dst, std::vector<QueueEntry> &out);
     /// Find is packet with given destination address exists in queue
-    bool Find (Ipv4Address dst);
-    /// Drop idx-th entry
-    void Drop (uint32_t idx);
+    bool Find (Ipv4Address dst) const;
+    /// Drop all entries with deadline before t, return number of dropped entries
+    uint32_t DropExpired (Time t);
+    /// Remove all entries without reporting them as dropped
+    void Clear ();
+    /// Earliest deadline of all entries, queue must not be empty
+    Time GetEarliestDeadline () const;
+    /// Get count of entries with deadline before t
+    uint32_t GetCountBefore (Time t) const;
+    /// Append deadlines of all entries to deadlines
+    void GetDeadlines (std::vector<Time> &deadlines) const;
+    /// Append destinations that have queued entries to destinations
+    void GetDestinations (std::vector<Ipv4Address> &destinations) const;
     /// Get count of packets with destination address dst
-    uint32_t GetCountForPacketsWithDst (Ipv4Address dst);
+    uint32_t GetCountForPacketsWithDst (Ipv4Address dst) const;
     /// Number of entries
-    uint32_t GetSize();
+    uint32_t GetSize() const;
+    /// Number of packet bytes in all entries
+    uint32_t GetBytes() const {return m_bytes;}
+    /// Changes every time an entry is added or removed
+    uint64_t GetVersion() const {return m_version;}
 
     // Fields
     Time GetQueueTimeout() const {return m_queueTimeout;}
     void SetQueueTimeout(Time t) {m_queueTimeout = t;}
-    QueueEntry& operator[] (size_t idx) {return m_queue[idx];}
+    /// Max number of entries, 0 for no limit
+    uint32_t GetMaxLen() const {return m_maxLen;}
+    void SetMaxLen(uint32_t len) {m_maxLen = len;}
+    /// Max number of packet bytes, 0 for no limit
+    uint32_t GetMaxBytes() const {return m_maxBytes;}
+    void SetMaxBytes(uint32_t bytes) {m_maxBytes = bytes;}
+    QueueDropPolicy GetDropPolicy() const {return m_dropPolicy;}
+    void SetDropPolicy(QueueDropPolicy policy) {m_dropPolicy = policy;}
+    void SetDropCallback(DropCallback cb) {m_dropCallback = cb;}
 
 
 private:
-    std::vector<QueueEntry> m_queue;
+    /// Entries for one destination, sorted by deadline
+    typedef std::deque<QueueEntry> Bucket;
+    std::map<Ipv4Address, Bucket> m_buckets;
+    // Number of entries in all buckets
+    uint32_t m_size;
+    // Number of packet bytes in all buckets
+    uint32_t m_bytes;
+    // Sequence number of next arriving entry
+    uint64_t m_sequence;
+    // Count of changes to the set of entries
+    uint64_t m_version;
+    uint32_t m_maxLen;
+    uint32_t m_maxBytes;
+    QueueDropPolicy m_dropPolicy;
+    DropCallback m_dropCallback;
+    // Event dropping expired entries, and the time it is scheduled for
+    EventId m_expiryEvent;
+    Time m_expiryTime;
+    /// Make sure expiry event runs no later than just after earliest deadline
+    void ScheduleExpiry ();
+    /// Drop expired entries and re-arm expiry event
+    void Expire ();
     // Max period of time that a routing protocol is allowed to buffer a packet (seconds)
     Time m_queueTimeout;
-    static bool 
-    IsEqual (QueueEntry en, const Ipv4Address dst)
+    /// True if queue has no room for another entry of size bytes
+    bool IsFull (uint32_t size) const;
+    /// Remove entry i of bucket b and report it to the drop callback
+    void DropAt (std::map<Ipv4Address, Bucket>::iterator b, Bucket::iterator i, QueueDropReason reason);
+    /// Make room for entry according to drop policy, false if entry itself has to be dropped
+    bool MakeRoom (QueueEntry const &entry);
+    static bool
+    IsBefore (QueueEntry const &en, Time t)
+    {
+        return (en.GetDeadline() < t);
+    }
+    static bool
+    IsAfter (Time t, QueueEntry const &en)
     {
-        return (en.GetIpv4Header().GetDestination() == dst);
+        return (t < en.GetDeadline());
     }
 };
 
@@ -22,38 +22,333 @@ RoutingTableEntry::RoutingTableEntry (Ptr<NetDevice> device,
                                       Ipv4Address dstAddr,
                                       Ipv4InterfaceAddress iface,
                                       Ipv4Address nextHop)
-    : m_iface (iface),
-      m_flag (VALID)
+    : m_destination (dstAddr),
+      m_source (iface.GetLocal ()),
+      m_nextHop (nextHop),
+      m_device (device),
+      m_ipv4Route (),
+      m_iface (iface),
+      m_flag (VALID),
+      m_holdDownExpiry ()
 {
-    m_ipv4Route = Create<Ipv4Route> ();
-    m_ipv4Route -> SetDestination (dstAddr);
-    m_ipv4Route -> SetGateway (nextHop);
-    m_ipv4Route -> SetSource(m_iface.GetLocal());
-    m_ipv4Route -> SetOutputDevice(device);
 }
 
 RoutingTableEntry::~RoutingTableEntry()
 {
 }
 
-RoutingTable::RoutingTable ()
+Ptr<Ipv4Route>
+RoutingTableEntry::GetRoute () const
+{
+    if (m_ipv4Route == 0)
+    {
+        m_ipv4Route = Create<Ipv4Route> ();
+        m_ipv4Route -> SetDestination (m_destination);
+        m_ipv4Route -> SetGateway (m_nextHop);
+        m_ipv4Route -> SetSource (m_source);
+        m_ipv4Route -> SetOutputDevice (m_device);
+    }
+    return m_ipv4Route;
+}
+
+RouteHashTable::RouteHashTable ()
+    : m_size (0),
+      m_mask (0),
+      m_shift (32)
+{
+}
+
+uint32_t
+RouteHashTable::Probe (uint32_t key) const
 {
+    uint32_t i = Home (key);
+    while (m_slots[i].used && m_slots[i].key != key)
+    {
+        i = (i + 1) & m_mask;
+    }
+    return i;
+}
+
+RoutingTableEntry*
+RouteHashTable::Find (Ipv4Address dst)
+{
+    if (m_size == 0)
+    {
+        return 0;
+    }
+    Slot &slot = m_slots[Probe (dst.Get ())];
+    return slot.used ? &slot.entry : 0;
+}
+
+const RoutingTableEntry*
+RouteHashTable::Find (Ipv4Address dst) const
+{
+    if (m_size == 0)
+    {
+        return 0;
+    }
+    const Slot &slot = m_slots[Probe (dst.Get ())];
+    return slot.used ? &slot.entry : 0;
 }
 
 bool
-RoutingTable::LookupRoute (Ipv4Address id,
-                           RoutingTableEntry &rtEntry)
+RouteHashTable::Insert (RoutingTableEntry const &entry)
+{
+    if (2 * (m_size + 1) > m_slots.size ())
+    {
+        Grow ();
+    }
+    uint32_t key = entry.GetDestination ().Get ();
+    Slot &slot = m_slots[Probe (key)];
+    if (slot.used)
+    {
+        return false;
+    }
+    slot.key = key;
+    slot.used = true;
+    slot.entry = entry;
+    m_size++;
+    return true;
+}
+
+bool
+RouteHashTable::Erase (Ipv4Address dst)
 {
-    if (m_ipv4AddressEntry.empty())
+    if (m_size == 0)
     {
         return false;
     }
-    std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.find (id);
-    if (i == m_ipv4AddressEntry.end())
+    uint32_t i = Probe (dst.Get ());
+    if (!m_slots[i].used)
     {
         return false;
     }
-    rtEntry = i->second;
+    EraseAt (i);
+    return true;
+}
+
+void
+RouteHashTable::EraseAt (uint32_t idx)
+{
+    NS_ASSERT (m_slots[idx].used);
+    uint32_t hole = idx;
+    uint32_t j = idx;
+    while (true)
+    {
+        j = (j + 1) & m_mask;
+        if (!m_slots[j].used)
+        {
+            break;
+        }
+        // Entry at j can fill the hole unless its home lies cyclically in (hole, j]
+        uint32_t home = Home (m_slots[j].key);
+        bool stays = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays)
+        {
+            m_slots[hole] = m_slots[j];
+            hole = j;
+        }
+    }
+    m_slots[hole].used = false;
+    m_slots[hole].entry = RoutingTableEntry ();
+    m_size--;
+}
+
+void
+RouteHashTable::Clear ()
+{
+    for (std::vector<Slot>::iterator i = m_slots.begin (); i != m_slots.end (); ++i)
+    {
+        if (i->used)
+        {
+            i->used = false;
+            i->entry = RoutingTableEntry ();
+        }
+    }
+    m_size = 0;
+}
+
+void
+RouteHashTable::Grow ()
+{
+    std::vector<Slot> old;
+    old.swap (m_slots);
+    uint32_t capacity = old.empty () ? 16 : 2 * old.size ();
+    m_slots.resize (capacity);
+    m_mask = capacity - 1;
+    m_shift = 32;
+    while (capacity > 1)
+    {
+        capacity >>= 1;
+        m_shift--;
+    }
+    for (std::vector<Slot>::const_iterator i = old.begin (); i != old.end (); ++i)
+    {
+        if (i->used)
+        {
+            Slot &slot = m_slots[Probe (i->key)];
+            slot = *i;
+        }
+    }
+}
+
+const uint64_t HoldDownWheel::NO_TICK = ~uint64_t (0);
+
+HoldDownWheel::HoldDownWheel ()
+    : m_current (0),
+      m_size (0)
+{
+}
+
+void
+HoldDownWheel::Schedule (uint32_t key, uint64_t expiry, uint64_t now)
+{
+    if (m_size == 0 && now > m_current)
+    {
+        // Nothing to cascade, catch up with the clock
+        m_current = now;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.expiry = expiry;
+    Place (entry);
+    m_size++;
+}
+
+void
+HoldDownWheel::Place (Entry const &entry)
+{
+    if (entry.expiry <= m_current)
+    {
+        m_due.push_back (entry);
+    }
+    else if ((entry.expiry >> L0_BITS) == (m_current >> L0_BITS))
+    {
+        m_level0[entry.expiry & L0_MASK].push_back (entry);
+    }
+    else if ((entry.expiry >> (L0_BITS + L1_BITS)) == (m_current >> (L0_BITS + L1_BITS)))
+    {
+        m_level1[(entry.expiry >> L0_BITS) & L1_MASK].push_back (entry);
+    }
+    else
+    {
+        m_overflow.push_back (entry);
+    }
+}
+
+void
+HoldDownWheel::Cascade (Slot &slot)
+{
+    Slot entries;
+    entries.swap (slot);
+    for (Slot::const_iterator i = entries.begin (); i != entries.end (); ++i)
+    {
+        Place (*i);
+    }
+}
+
+void
+HoldDownWheel::Step (std::vector<uint32_t> &expired)
+{
+    m_current++;
+    if ((m_current & SUPER_MASK) == 0)
+    {
+        Cascade (m_overflow);
+    }
+    if ((m_current & L0_MASK) == 0)
+    {
+        Cascade (m_level1[(m_current >> L0_BITS) & L1_MASK]);
+    }
+    Slot &slot = m_level0[m_current & L0_MASK];
+    for (Slot::const_iterator i = m_due.begin (); i != m_due.end (); ++i)
+    {
+        expired.push_back (i->key);
+    }
+    for (Slot::const_iterator i = slot.begin (); i != slot.end (); ++i)
+    {
+        expired.push_back (i->key);
+    }
+    m_size -= m_due.size () + slot.size ();
+    m_due.clear ();
+    slot.clear ();
+}
+
+void
+HoldDownWheel::Advance (uint64_t now, std::vector<uint32_t> &expired)
+{
+    while (m_current < now)
+    {
+        uint64_t next = GetNextTick ();
+        if (next > now)
+        {
+            // No slot with entries is reached, skipping ticks cannot miss a cascade
+            m_current = now;
+            break;
+        }
+        m_current = next - 1;
+        Step (expired);
+    }
+    // Entries scheduled at or before the current tick
+    for (Slot::const_iterator i = m_due.begin (); i != m_due.end (); ++i)
+    {
+        expired.push_back (i->key);
+    }
+    m_size -= m_due.size ();
+    m_due.clear ();
+}
+
+uint64_t
+HoldDownWheel::GetNextTick () const
+{
+    if (m_size == 0)
+    {
+        return NO_TICK;
+    }
+    if (!m_due.empty ())
+    {
+        return m_current;
+    }
+    uint64_t block = m_current & ~L0_MASK;
+    for (uint64_t i = (m_current & L0_MASK) + 1; i < L0_SLOTS; i++)
+    {
+        if (!m_level0[i].empty ())
+        {
+            return block + i;
+        }
+    }
+    uint64_t super = m_current & ~SUPER_MASK;
+    for (uint64_t i = ((m_current >> L0_BITS) & L1_MASK) + 1; i < L1_SLOTS; i++)
+    {
+        if (!m_level1[i].empty ())
+        {
+            return super + (i << L0_BITS);
+        }
+    }
+    NS_ASSERT (!m_overflow.empty ());
+    return super + SUPER_MASK + 1;
+}
+
+RoutingTable::RoutingTable ()
+    : m_holdDownTick (MilliSeconds (100)),
+      m_holdDownEventTick (HoldDownWheel::NO_TICK)
+{
+}
+
+RoutingTable::~RoutingTable ()
+{
+    m_holdDownEvent.Cancel ();
+}
+
+bool
+RoutingTable::LookupRoute (Ipv4Address id,
+                           RoutingTableEntry &rtEntry)
+{
+    const RoutingTableEntry *entry = FindRoute (id);
+    if (entry == 0)
+    {
+        return false;
+    }
+    rtEntry = *entry;
     return true;
 }
 
@@ -62,77 +357,111 @@ RoutingTable::LookupRoute (Ipv4Address id,
                            RoutingTableEntry &rtEntry,
                            bool forRouteInput)
 {
-    if (m_ipv4AddressEntry.empty())
+    const RoutingTableEntry *entry = FindRoute (id, forRouteInput);
+    if (entry == 0)
     {
         return false;
     }
-    std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.find (id);
-    if (i == m_ipv4AddressEntry.end())
+    rtEntry = *entry;
+    return true;
+}
+
+const RoutingTableEntry*
+RoutingTable::FindRoute (Ipv4Address id) const
+{
+    const RoutingTableEntry *entry = m_ipv4AddressEntry.Find (id);
+    if (entry != 0 && entry->IsHeldDown())
     {
-        return false;
+        return 0;
     }
-    if (forRouteInput == true && id == i->second.GetInterface().GetBroadcast())
+    return entry;
+}
+
+const RoutingTableEntry*
+RoutingTable::FindRoute (Ipv4Address id, bool forRouteInput) const
+{
+    const RoutingTableEntry *entry = FindRoute (id);
+    if (entry != 0 && forRouteInput == true && id == entry->GetInterface().GetBroadcast())
     {
-        return false;
+        return 0;
     }
-    rtEntry = i->second;
-    return true;
+    return entry;
 }
 
 bool
 RoutingTable::DeleteRoute (Ipv4Address dstAddr)
 {
-    if (m_ipv4AddressEntry.erase(dstAddr) != 0)
+    const RoutingTableEntry *entry = m_ipv4AddressEntry.Find (dstAddr);
+    if (entry == 0)
+    {
+        return false;
+    }
+    UnindexRoute (*entry);
+    bool erased = m_ipv4AddressEntry.Erase (dstAddr);
+    if (erased && !m_removeCallback.IsNull())
     {
-        return true;
+        m_removeCallback (dstAddr);
     }
-    return false;
+    return erased;
 }
 
 uint32_t
 RoutingTable::RoutingTableSize ()
 {
-    return m_ipv4AddressEntry.size();
+    return m_ipv4AddressEntry.GetSize();
 }
 
 bool 
 RoutingTable::AddRoute(RoutingTableEntry &routingTableEntry)
 {
-    std::pair<std::map<Ipv4Address, RoutingTableEntry>::iterator, bool> result = m_ipv4AddressEntry.insert (std::make_pair (routingTableEntry.GetDestination(), routingTableEntry));
-
-    return result.second;
+    const RoutingTableEntry *existing = m_ipv4AddressEntry.Find (routingTableEntry.GetDestination());
+    if (existing != 0 && existing->IsHeldDown())
+    {
+        // Route came back before its hold down expired, reuse the slot
+        return Update (routingTableEntry);
+    }
+    if (!m_ipv4AddressEntry.Insert (routingTableEntry))
+    {
+        return false;
+    }
+    IndexRoute (routingTableEntry);
+    return true;
 }
 
 bool
 RoutingTable::Update (RoutingTableEntry &rtEntry)
 {
-    std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.find (rtEntry.GetDestination());
-    if (i == m_ipv4AddressEntry.end())
+    RoutingTableEntry *entry = m_ipv4AddressEntry.Find (rtEntry.GetDestination());
+    if (entry == 0)
     {
         return false;
     }
-    i->second = rtEntry;
+    if (entry->GetNextHop() != rtEntry.GetNextHop() || entry->GetInterface() != rtEntry.GetInterface())
+    {
+        UnindexRoute (*entry);
+        IndexRoute (rtEntry);
+    }
+    *entry = rtEntry;
     return true;
 }
 
 void
 RoutingTable::DeleteAllRouteFromInterface(Ipv4InterfaceAddress iface)
 {
-    if (m_ipv4AddressEntry.empty())
+    AddressIndex::const_iterator bucket = m_interfaceIndex.find (iface.GetLocal().Get());
+    if (bucket == m_interfaceIndex.end())
     {
         return;
     }
-    for (std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.begin(); i != m_ipv4AddressEntry.end(); )
+    // DeleteRoute edits the bucket, walk a copy of it
+    std::vector<uint32_t> dsts = bucket->second;
+    for (std::vector<uint32_t>::const_iterator i = dsts.begin(); i != dsts.end(); ++i)
     {
-        if (i->second.GetInterface() == iface)
-        {
-            std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-            ++i;
-            m_ipv4AddressEntry.erase(tmp);
-        }
-        else 
+        Ipv4Address dst (*i);
+        const RoutingTableEntry *entry = m_ipv4AddressEntry.Find (dst);
+        if (entry != 0 && entry->GetInterface() == iface)
         {
-            ++i;
+            DeleteRoute (dst);
         }
     }
 }
@@ -140,12 +469,17 @@ RoutingTable::DeleteAllRouteFromInterface(Ipv4InterfaceAddress iface)
 void
 RoutingTable::GetListOfAllRoutes(std::map<Ipv4Address, RoutingTableEntry> &allRoutes)
 {
-    for (std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.begin(); i != m_ipv4AddressEntry.end(); ++i)
+    for (uint32_t i = 0; i < m_ipv4AddressEntry.GetCapacity(); ++i)
     {
-        if (i->second.GetDestination() != Ipv4Address("127.0.0.1") && i->second.GetFlag()==VALID)
+        if (!m_ipv4AddressEntry.IsUsed(i))
+        {
+            continue;
+        }
+        const RoutingTableEntry &entry = m_ipv4AddressEntry.GetEntry(i);
+        if (entry.GetDestination() != Ipv4Address("127.0.0.1") && entry.GetFlag()==VALID)
         {
             allRoutes.insert(
-                    std::make_pair(i->first, i->second));
+                    std::make_pair(entry.GetDestination(), entry));
         }
     }
 }
@@ -154,122 +488,183 @@ void
 RoutingTable::GetListOfDestinationWithNextHop(Ipv4Address nextHop, std::map<Ipv4Address, RoutingTableEntry> &dstList)
 {
     dstList.clear();
-    for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.begin(); 
-         i != m_ipv4AddressEntry.end(); ++i)
+    AddressIndex::const_iterator bucket = m_nextHopIndex.find (nextHop.Get());
+    if (bucket == m_nextHopIndex.end())
+    {
+        return;
+    }
+    for (std::vector<uint32_t>::const_iterator i = bucket->second.begin(); i != bucket->second.end(); ++i)
     {
-        if (i->second.GetNextHop() == nextHop)
+        const RoutingTableEntry *entry = m_ipv4AddressEntry.Find (Ipv4Address (*i));
+        NS_ASSERT (entry != 0);
+        // Held-down routes stay indexed until they expire, FindRoute hides them too
+        if (entry->IsHeldDown())
         {
-            dstList.insert(std::make_pair (i->first, i->second));
+            continue;
         }
+        dstList.insert(std::make_pair (entry->GetDestination(), *entry));
     }
 }
 
 void
-RoutingTableEntry::Print(Ptr<OutputStreamWrapper> stream) const
+RoutingTable::GetListOfDestinationWithNextHop(Ipv4Address nextHop, std::vector<Ipv4Address> &dstList) const
 {
-    *stream->GetStream() << std::setiosflags(std::ios::fixed) << m_ipv4Route->GetDestination() 
-        << "\t\t" << m_ipv4Route->GetGateway() << "\t\t" << m_iface.GetLocal() << "\n";
-}
-
-void
-RoutingTable::Print(Ptr<OutputStreamWrapper> stream) const
-{
-    *stream->GetStream() << "\nLEACH Routing table" << "DST\t\tDestination\t\tGateway\t\t\tInterface\n";
-    for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.begin(); 
-            i != m_ipv4AddressEntry.end(); ++i)
+    dstList.clear();
+    AddressIndex::const_iterator bucket = m_nextHopIndex.find (nextHop.Get());
+    if (bucket == m_nextHopIndex.end())
     {
-        i->first.Print (*stream->GetStream());
-        *stream->GetStream() << "\t\t";
-        i->second.Print(stream);
+        return;
+    }
+    for (std::vector<uint32_t>::const_iterator i = bucket->second.begin(); i != bucket->second.end(); ++i)
+    {
+        if (FindRoute (Ipv4Address (*i)) != 0)
+        {
+            dstList.push_back (Ipv4Address (*i));
+        }
     }
-    *stream->GetStream() << "\n";
-}
-
-bool
-RoutingTable::AddIpv4Event(Ipv4Address address, EventId id)
-{
-    std::pair<std::map<Ipv4Address, EventId>::iterator, bool> result = m_ipv4Events.insert(std::make_pair(address, id));
-    return result.second;
 }
 
 bool
-RoutingTable::AnyRunningEvent(Ipv4Address address)
+RoutingTable::HoldDownRoute (Ipv4Address dstAddr)
 {
-    EventId event;
-    std::map<Ipv4Address, EventId>::const_iterator i = m_ipv4Events.find(address);
-    if (m_ipv4Events.empty())
+    RoutingTableEntry *entry = m_ipv4AddressEntry.Find (dstAddr);
+    if (entry == 0)
     {
         return false;
     }
-    if (i == m_ipv4Events.end())
-    {
-        return true;
-    }
-    event = i->second;
-    if (event.IsRunning())
+    if (!m_holdDownTime.IsStrictlyPositive())
     {
-        return true;
+        return DeleteRoute (dstAddr);
     }
-    else 
+    Time expiry = Simulator::Now() + m_holdDownTime;
+    entry->SetFlag (INVALID);
+    entry->SetHoldDownExpiry (expiry);
+    int64_t tick = m_holdDownTick.GetTimeStep();
+    // Round up so a route is never purged before its hold down time
+    uint64_t expiryTick = (expiry.GetTimeStep() + tick - 1) / tick;
+    m_holdDownWheel.Schedule (dstAddr.Get(), expiryTick, Simulator::Now().GetTimeStep() / tick);
+    ScheduleHoldDownEvent ();
+    if (!m_removeCallback.IsNull())
     {
-        return false;
+        m_removeCallback (dstAddr);
     }
+    return true;
 }
 
-bool
-RoutingTable::ForceDeleteIpv4Event(Ipv4Address address)
+void
+RoutingTable::HoldDownExpire ()
 {
-    EventId event;
-    std::map<Ipv4Address, EventId>::const_iterator i = m_ipv4Events.find(address);
-    if (m_ipv4Events.empty() || i == m_ipv4Events.end())
+    m_holdDownEventTick = HoldDownWheel::NO_TICK;
+    m_holdDownExpired.clear();
+    m_holdDownWheel.Advance (Simulator::Now().GetTimeStep() / m_holdDownTick.GetTimeStep(), m_holdDownExpired);
+    for (std::vector<uint32_t>::const_iterator i = m_holdDownExpired.begin(); i != m_holdDownExpired.end(); ++i)
     {
-        return false;
+        Ipv4Address dst (*i);
+        const RoutingTableEntry *entry = m_ipv4AddressEntry.Find (dst);
+        // Skip routes that were re-added, or held down again later
+        if (entry != 0 && entry->IsHeldDown() && entry->GetHoldDownExpiry() <= Simulator::Now())
+        {
+            NS_LOG_DEBUG ("Hold down expired for " << dst);
+            DeleteRoute (dst);
+        }
     }
-    event = i->second;
-    Simulator::Cancel(event);
-    m_ipv4Events.erase(address);
-    return true;
+    ScheduleHoldDownEvent ();
 }
 
-bool
-RoutingTable::DeleteIpv4Event(Ipv4Address address)
+void
+RoutingTable::ScheduleHoldDownEvent ()
 {
-    EventId event;
-    std::map<Ipv4Address, EventId>::const_iterator i = m_ipv4Events.find(address);
-    if (m_ipv4Events.empty() || i == m_ipv4Events.end())
+    uint64_t next = m_holdDownWheel.GetNextTick();
+    if (next == m_holdDownEventTick)
     {
-        return false;
+        return;
     }
-    event = i->second;
-    if (event.IsRunning())
+    m_holdDownEvent.Cancel();
+    m_holdDownEventTick = next;
+    if (next == HoldDownWheel::NO_TICK)
     {
-        return false;
+        return;
     }
-    if (event.IsExpired())
+    Time at = TimeStep (next * m_holdDownTick.GetTimeStep());
+    Time delay = (at > Simulator::Now()) ? at - Simulator::Now() : Time (0);
+    m_holdDownEvent = Simulator::Schedule (delay, &RoutingTable::HoldDownExpire, this);
+}
+
+void
+RoutingTable::IndexRoute (RoutingTableEntry const &entry)
+{
+    uint32_t dst = entry.GetDestination().Get();
+    AddToIndex (m_nextHopIndex, entry.GetNextHop().Get(), dst);
+    AddToIndex (m_interfaceIndex, entry.GetInterface().GetLocal().Get(), dst);
+}
+
+void
+RoutingTable::UnindexRoute (RoutingTableEntry const &entry)
+{
+    uint32_t dst = entry.GetDestination().Get();
+    RemoveFromIndex (m_nextHopIndex, entry.GetNextHop().Get(), dst);
+    RemoveFromIndex (m_interfaceIndex, entry.GetInterface().GetLocal().Get(), dst);
+}
+
+void
+RoutingTable::AddToIndex (AddressIndex &index, uint32_t key, uint32_t dst)
+{
+    index[key].push_back (dst);
+}
+
+void
+RoutingTable::RemoveFromIndex (AddressIndex &index, uint32_t key, uint32_t dst)
+{
+    AddressIndex::iterator bucket = index.find (key);
+    if (bucket == index.end())
     {
-        event.Cancel();
-        m_ipv4Events.erase(address);
-        return true;
+        return;
+    }
+    std::vector<uint32_t> &dsts = bucket->second;
+    for (std::vector<uint32_t>::iterator i = dsts.begin(); i != dsts.end(); ++i)
+    {
+        if (*i == dst)
+        {
+            *i = dsts.back();
+            dsts.pop_back();
+            break;
+        }
     }
-    else 
+    if (dsts.empty())
     {
-        m_ipv4Events.erase(address);
-        return true;
+        index.erase (bucket);
     }
 }
 
-EventId
-RoutingTable::GetEventId(Ipv4Address address)
+void
+RoutingTableEntry::Print(Ptr<OutputStreamWrapper> stream) const
+{
+    *stream->GetStream() << std::setiosflags(std::ios::fixed) << m_destination 
+        << "\t\t" << m_nextHop << "\t\t" << m_iface.GetLocal() << "\n";
+}
+
+void
+RoutingTable::Print(Ptr<OutputStreamWrapper> stream) const
 {
-    std::map<Ipv4Address, EventId>::const_iterator i = m_ipv4Events.find(address);
-    if (m_ipv4Events.empty() || i == m_ipv4Events.end())
+    *stream->GetStream() << "\nLEACH Routing table" << "DST\t\tDestination\t\tGateway\t\t\tInterface\n";
+    // Print in address order, slot order depends on the hash
+    std::map<Ipv4Address, const RoutingTableEntry*> sorted;
+    for (uint32_t i = 0; i < m_ipv4AddressEntry.GetCapacity(); ++i)
     {
-        return EventId();
+        if (m_ipv4AddressEntry.IsUsed(i))
+        {
+            const RoutingTableEntry &entry = m_ipv4AddressEntry.GetEntry(i);
+            sorted.insert(std::make_pair(entry.GetDestination(), &entry));
+        }
     }
-    else
+    for (std::map<Ipv4Address, const RoutingTableEntry*>::const_iterator i = sorted.begin(); 
+            i != sorted.end(); ++i)
     {
-        return i->second;
+        i->first.Print (*stream->GetStream());
+        *stream->GetStream() << "\t\t";
+        i->second->Print(stream);
     }
+    *stream->GetStream() << "\n";
 }
 
 } /* namespace leach */
@@ -4,13 +4,17 @@
 #include <bits/stdint-uintn.h>
 #include <cassert>
 #include <map>
+#include <vector>
 #include <sys/types.h>
 
+#include "ns3/assert.h"
+#include "ns3/callback.h"
 #include "ns3/event-id.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/ipv4-interface-address.h"
 #include "ns3/ipv4.h"
 #include "ns3/ipv4-route.h"
+#include "ns3/nstime.h"
 #include "ns3/ptr.h"
 #include "ns3/timer.h"
 #include "ns3/net-device.h"
@@ -29,6 +33,12 @@ enum RouteFlags
 /**
  * \ingroup leach
  * \brief Routing table entry
+ *
+ * Entry is a plain value, destination, source, gateway and output device are
+ * stored inline and copying an entry copies all of them. The Ipv4Route handed
+ * to IP is only created on first GetRoute() and is shared by copies of the
+ * entry until one of the route fields is changed, so it must not be modified
+ * by the caller.
  */
 class RoutingTableEntry
 {
@@ -36,59 +46,74 @@ public:
     RoutingTableEntry (Ptr<NetDevice> dev = 0, Ipv4Address dstAddr = Ipv4Address (),
                        Ipv4InterfaceAddress iface = Ipv4InterfaceAddress (), Ipv4Address nextHopAddr = Ipv4Address ());
 
+    RoutingTableEntry (RoutingTableEntry const &from) = default;
+    RoutingTableEntry (RoutingTableEntry &&from) = default;
+    RoutingTableEntry&
+    operator= (RoutingTableEntry const &from) = default;
+    RoutingTableEntry&
+    operator= (RoutingTableEntry &&from) = default;
+
     ~RoutingTableEntry ();
 
     void
     Reset ()
     {
         m_iface = Ipv4InterfaceAddress ();
-        m_ipv4Route -> SetDestination (Ipv4Address ());
-        m_ipv4Route -> SetGateway (Ipv4Address ());
-        m_ipv4Route -> SetSource(m_iface.GetLocal());
+        m_destination = Ipv4Address ();
+        m_nextHop = Ipv4Address ();
+        m_source = m_iface.GetLocal ();
+        m_ipv4Route = 0;
         m_flag = VALID;
+        m_holdDownExpiry = Time ();
     }
 
     void
-    Copy (RoutingTableEntry from)
+    Copy (RoutingTableEntry const &from)
     {
-        ;
+        *this = from;
     }
 
     Ipv4Address
     GetDestination() const
     {
-        return m_ipv4Route->GetDestination();
+        return m_destination;
     }
-    Ptr<Ipv4Route>
-    GetRoute () const
-    {
-        return m_ipv4Route;
-    }
-    void 
-    SetRoute (Ptr<Ipv4Route> route)
+    void
+    SetDestination (Ipv4Address destination)
     {
-        m_ipv4Route = route;
+        m_destination = destination;
+        m_ipv4Route = 0;
     }
+    /// Ip route of the entry, created on first use
+    Ptr<Ipv4Route>
+    GetRoute () const;
     void
     SetNextHop (Ipv4Address nextHop)
     {
-        m_ipv4Route -> SetGateway (nextHop);
+        m_nextHop = nextHop;
+        m_ipv4Route = 0;
     }
     Ipv4Address
     GetNextHop () const
     {
-        return m_ipv4Route->GetGateway();
+        return m_nextHop;
+    }
+    Ipv4Address
+    GetSource () const
+    {
+        return m_source;
     }
 
     void 
     SetOutputDevice (Ptr<NetDevice> outputDevice)
     {
-        m_ipv4Route->SetOutputDevice(outputDevice);
+        m_device = outputDevice;
+        m_ipv4Route = 0;
     }
     Ptr<NetDevice>
     GetOutputDevice () const
     {
-        return m_ipv4Route->GetOutputDevice ();
+        return m_device;
     }
       Ipv4InterfaceAddress
     GetInterface () const
@@ -111,6 +136,24 @@ public:
     {
         return m_flag;
     }
+
+    /// Time at which a held down route is purged, zero if the route is not held down
+    void
+    SetHoldDownExpiry (Time t)
+    {
+        m_holdDownExpiry = t;
+    }
+    Time
+    GetHoldDownExpiry () const
+    {
+        return m_holdDownExpiry;
+    }
+    /// Route was invalidated and waits in hold down to be purged
+    bool
+    IsHeldDown () const
+    {
+        return m_flag == INVALID && !m_holdDownExpiry.IsZero ();
+    }
     /**
      * \brief Compare destination address
      * \return true if equal
@@ -118,32 +161,234 @@ public:
     bool
     operator== (Ipv4Address const destination) const
     {
-        return (m_ipv4Route->GetDestination () == destination);
+        return (m_destination == destination);
     }
     void
     Print (Ptr<OutputStreamWrapper> stream) const;
 
 private:
     // Fields
-    /**
-     * Ip route, include
-     *  - destination address
-     *  - source address
-     *  - next hop address (gateway)
-     *  - output device
-     */
-    Ptr<Ipv4Route> m_ipv4Route;
+    // Destination address
+    Ipv4Address m_destination;
+    // Source address
+    Ipv4Address m_source;
+    // Next hop address (gateway)
+    Ipv4Address m_nextHop;
+    // Output device
+    Ptr<NetDevice> m_device;
+    // Ip route built from the fields above, 0 until GetRoute is called
+    mutable Ptr<Ipv4Route> m_ipv4Route;
     // Output interface address
     Ipv4InterfaceAddress m_iface;
     // Routing Flags: valid, invalid or searching
     RouteFlags m_flag;
+    // Hold down expiry of an invalidated route
+    Time m_holdDownExpiry;
+
+};
+
+/**
+ * \ingroup leach
+ * \brief Flat open-addressing hash table of routing table entries
+ *
+ * Entries are stored by value in a single array of slots, keyed by the raw
+ * 32-bit destination address. Collisions are resolved with linear probing
+ * and removals shift the following entries back, so there are no tombstones
+ * and a probe sequence stays short. The table grows by doubling and is kept
+ * at most half full.
+ */
+class RouteHashTable
+{
+public:
+    RouteHashTable ();
+
+    /**
+     * Find entry for destination address
+     * \param dst destination address
+     * \return pointer to stored entry, or 0 if there is none
+     */
+    RoutingTableEntry*
+    Find (Ipv4Address dst);
+    const RoutingTableEntry*
+    Find (Ipv4Address dst) const;
+
+    /**
+     * Insert entry if there is no entry with same destination address
+     * \param entry routing table entry
+     * \return true on success
+     */
+    bool
+    Insert (RoutingTableEntry const &entry);
 
+    /**
+     * Erase entry for destination address
+     * \param dst destination address
+     * \return true on success
+     */
+    bool
+    Erase (Ipv4Address dst);
+
+    /**
+     * Erase entry stored in slot idx. Entries following idx may be moved
+     * into idx, so when erasing while walking slots do not advance past idx.
+     * \param idx slot index
+     */
+    void
+    EraseAt (uint32_t idx);
+
+    /// Remove all entries, capacity is kept
+    void
+    Clear ();
+
+    uint32_t
+    GetSize () const
+    {
+        return m_size;
+    }
+
+    // Slot access, used to walk the whole table
+    uint32_t
+    GetCapacity () const
+    {
+        return m_slots.size ();
+    }
+    bool
+    IsUsed (uint32_t idx) const
+    {
+        return m_slots[idx].used;
+    }
+    RoutingTableEntry&
+    GetEntry (uint32_t idx)
+    {
+        return m_slots[idx].entry;
+    }
+    const RoutingTableEntry&
+    GetEntry (uint32_t idx) const
+    {
+        return m_slots[idx].entry;
+    }
+
+private:
+    struct Slot
+    {
+        Slot ()
+            : key (0),
+              used (false)
+        {
+        }
+        /// Raw destination address, kept next to the flag so probing does not touch the entry
+        uint32_t key;
+        bool used;
+        RoutingTableEntry entry;
+    };
+
+    /// Home slot of key
+    uint32_t
+    Home (uint32_t key) const
+    {
+        // Fibonacci hashing, node addresses differ mostly in the low bits
+        return (key * 2654435769u) >> m_shift;
+    }
+    /// Index of the slot holding key, or of the empty slot ending its probe sequence
+    uint32_t
+    Probe (uint32_t key) const;
+    /// Double the number of slots and re-insert all entries
+    void
+    Grow ();
+
+    std::vector<Slot> m_slots;
+    uint32_t m_size;
+    uint32_t m_mask;
+    uint32_t m_shift;
+};
+
+/**
+ * \ingroup leach
+ * \brief Hierarchical timing wheel of route hold down expiries
+ *
+ * Time is counted in ticks. Level 0 has one slot per tick of the current block of
+ * L0_SLOTS ticks, level 1 has one slot per block of the current super block of
+ * L1_SLOTS blocks, and anything further away waits in an overflow list. Slots are
+ * cascaded down when their block or super block starts, so scheduling is O(1) and
+ * each entry is moved at most twice before it expires.
+ */
+class HoldDownWheel
+{
+public:
+    HoldDownWheel ();
+
+    /**
+     * Schedule key to expire at tick expiry
+     * \param key raw destination address
+     * \param expiry tick at which key expires
+     * \param now current tick
+     */
+    void
+    Schedule (uint32_t key, uint64_t expiry, uint64_t now);
+
+    /**
+     * Advance the wheel to tick now
+     * \param now current tick
+     * \param expired keys that expired on the way are appended here
+     */
+    void
+    Advance (uint64_t now, std::vector<uint32_t> &expired);
+
+    /// Earliest tick at which Advance has work to do, NO_TICK when empty
+    uint64_t
+    GetNextTick () const;
+
+    bool
+    IsEmpty () const
+    {
+        return m_size == 0;
+    }
+
+    static const uint64_t NO_TICK;
+
+private:
+    static const uint32_t L0_BITS = 6;
+    static const uint32_t L1_BITS = 6;
+    static const uint32_t L0_SLOTS = 1 << L0_BITS;
+    static const uint32_t L1_SLOTS = 1 << L1_BITS;
+    static const uint64_t L0_MASK = L0_SLOTS - 1;
+    static const uint64_t L1_MASK = L1_SLOTS - 1;
+    static const uint64_t SUPER_MASK = (uint64_t (1) << (L0_BITS + L1_BITS)) - 1;
+
+    struct Entry
+    {
+        uint32_t key;
+        uint64_t expiry;
+    };
+    typedef std::vector<Entry> Slot;
+
+    /// Put entry in the slot matching its distance from the current tick
+    void
+    Place (Entry const &entry);
+    /// Move all entries of slot back through Place
+    void
+    Cascade (Slot &slot);
+    /// Move one tick forward and collect what expires on it
+    void
+    Step (std::vector<uint32_t> &expired);
+
+    Slot m_level0[L0_SLOTS];
+    Slot m_level1[L1_SLOTS];
+    Slot m_overflow;
+    /// Entries already due, expired by the next Advance
+    Slot m_due;
+    uint64_t m_current;
+    uint32_t m_size;
 };
 
 class RoutingTable
 {
 public:
+    /// Called with the destination of a route that was deleted or held down
+    typedef Callback<void, Ipv4Address> RemoveCallback;
+
     RoutingTable ();
+    ~RoutingTable ();
 
     /**
      * Add Routing table entry if it doesn't exist in routing table
@@ -172,6 +417,20 @@ public:
     bool
     LookupRoute (Ipv4Address id, RoutingTableEntry &rtEntry, bool forRouteInput);
 
+    /**
+     * Lookup routing table entry with destination address dstAddr without copying it
+     * \param dstAddr destination address
+     * \return the stored entry, or 0 if there is none. The pointer is only valid
+     *         until the routing table is next modified
+     */
+    const RoutingTableEntry*
+    FindRoute (Ipv4Address dstAddr) const;
+    /**
+     * Same as above, but when forRouteInput is set, local broadcast entries are not returned
+     */
+    const RoutingTableEntry*
+    FindRoute (Ipv4Address dstAddr, bool forRouteInput) const;
+
     /**
      * Update route table entry with route table entry rtEntry
      * \param rtEntry routing table entry
@@ -181,12 +440,18 @@ public:
     Update (RoutingTableEntry &rtEntry);
 
     /**
-     * Lookup list of address for which nextHop is next hop address
+     * Lookup list of address for which nextHop is next hop address, held-down routes are left out
      * \param nextHop is address for which we want list of destination
      * \param dstList is list holding all destination addresses
      */
     void
     GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, RoutingTableEntry> &dstList);
+    /**
+     * Same as above, but only collects destination addresses. The list is cleared
+     * first, so callers can reuse it between calls without reallocating
+     */
+    void
+    GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::vector<Ipv4Address> &dstList) const;
 
     /**
      * Lookup list of address in routing table
@@ -206,7 +471,9 @@ public:
     void
     Clear ()
     {
-        m_ipv4AddressEntry.clear();
+        m_ipv4AddressEntry.Clear();
+        m_nextHopIndex.clear();
+        m_interfaceIndex.clear();
     }
 
     /// Print Routing Table
@@ -217,50 +484,6 @@ public:
     uint32_t
     RoutingTableSize ();
 
-    /**
-     * Add an event for a destination address so update that the update to for that destination is sent
-     * after the event is completed
-     * \param address destination address for which this event is running
-     * \param id unique eventid that was generated
-     * \return true on success
-     */
-    bool
-    AddIpv4Event (Ipv4Address address, EventId id);
-
-    /**
-     * Clear up entry from map after event is complete
-     * \param address destination for which event is running
-     * \return true on success
-     */
-    bool 
-    DeleteIpv4Event (Ipv4Address address);
-
-    /**
-     * Check if event is running
-     * \param address destination address for which event is running
-     * \return true on success
-     */
-    bool
-    AnyRunningEvent (Ipv4Address address);
-
-    /**
-     * Force Delete an update waiting for settling time to complete as better update to 
-     * same address was recieved
-     * \param address destination address for which event is running
-     * \return true on success
-     */
-    bool
-    ForceDeleteIpv4Event (Ipv4Address address);
-
-    /**
-     * Get eventid associated with that address
-     * \param address destination address for which event is running
-     * \return EventId on finding out an event associated 
-     *         else return NULL
-     */
-    EventId
-    GetEventId (Ipv4Address address);
-
     // Handle life time of invalid route
     Time
     GetHoldDownTime () const
@@ -272,17 +495,70 @@ public:
     {
         m_holdDownTime = t;
     }
+    /// Granularity of hold down expiry, expiries within one tick are purged together
+    void
+    SetHoldDownTick (Time t)
+    {
+        NS_ASSERT (m_holdDownWheel.IsEmpty () && t.IsStrictlyPositive ());
+        m_holdDownTick = t;
+    }
+
+    /**
+     * Invalidate route for destination address and purge it once the hold down
+     * time has passed. Until then lookups ignore it, and AddRoute may replace it.
+     * \param dstAddr destination address
+     * \return true on success
+     */
+    bool
+    HoldDownRoute (Ipv4Address dstAddr);
+
+    /// Callback told about every route lookups stop returning, except on Clear
+    void
+    SetRemoveCallback (RemoveCallback cb)
+    {
+        m_removeCallback = cb;
+    }
 
 
 private:
     // Fields
     /// an entry in routing table
-    std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;
-    ///an entry in event table
-    std::map<Ipv4Address, EventId> m_ipv4Events;
+    RouteHashTable m_ipv4AddressEntry;
+    /// Secondary index type: raw address -> raw destination addresses
+    typedef std::map<uint32_t, std::vector<uint32_t> > AddressIndex;
+    /// Destinations per next hop address
+    AddressIndex m_nextHopIndex;
+    /// Destinations per local address of the output interface
+    AddressIndex m_interfaceIndex;
 
     Time m_holdDownTime;
-    
+    /// Hold down expiries, all entries due in one tick are purged by a single event
+    HoldDownWheel m_holdDownWheel;
+    Time m_holdDownTick;
+    EventId m_holdDownEvent;
+    /// Tick m_holdDownEvent is scheduled for
+    uint64_t m_holdDownEventTick;
+    /// Scratch list of expired keys, kept to avoid reallocating on every tick
+    std::vector<uint32_t> m_holdDownExpired;
+    RemoveCallback m_removeCallback;
+
+    /// Purge held down routes that expired, then re-arm the event
+    void
+    HoldDownExpire ();
+    /// Schedule m_holdDownEvent for the next tick the wheel has work on
+    void
+    ScheduleHoldDownEvent ();
+
+    /// Add entry to the secondary indexes
+    void
+    IndexRoute (RoutingTableEntry const &entry);
+    /// Remove entry from the secondary indexes
+    void
+    UnindexRoute (RoutingTableEntry const &entry);
+    static void
+    AddToIndex (AddressIndex &index, uint32_t key, uint32_t dst);
+    static void
+    RemoveFromIndex (AddressIndex &index, uint32_t key, uint32_t dst);
 };
 
 } /* namespace leach */
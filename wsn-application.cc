@@ -19,6 +19,7 @@
 #include "ns3/udp-socket-factory.h"
 #include "ns3/string.h"
 #include "ns3/pointer.h"
+#include "ns3/ipv4.h"
 #include "LeachPacket.h"
 
 #include <cmath>
@@ -40,7 +41,7 @@ WsnApplication::GetTypeId (void)
                        DataRateValue (DataRate ("500kb/s")),
                        MakeDataRateAccessor (&WsnApplication::m_cbrRate),
                        MakeDataRateChecker ())
-        .AddAttribute ("PacketSize", "The size of packets sent in on state",
+        .AddAttribute ("PacketSize", "The size used to pace packets at DataRate in on state, records are not padded to it",
                        UintegerValue (512),
                        MakeUintegerAccessor (&WsnApplication::m_pktSize),
                        MakeUintegerChecker<uint32_t> (1))
@@ -64,6 +65,10 @@ WsnApplication::GetTypeId (void)
                        IntegerValue (0),
                        MakeIntegerAccessor (&WsnApplication::m_pktGenPattern),
                        MakeIntegerChecker <int>())
+        .AddAttribute ("Reading", "A RandomVariableStream used to pick the sensor reading carried by each packet",
+                       StringValue ("ns3::ConstantRandomVariable[Constant=0.0]"),
+                       MakePointerAccessor (&WsnApplication::m_reading),
+                       MakePointerChecker <RandomVariableStream>())
         .AddAttribute ("MaxBytes", 
                        "The total number of bytes to send. Once these bytes are sent, "
                        "no packet is sent again, even in on state. The value zero means "
@@ -154,6 +159,12 @@ void WsnApplication::StartApplication () // Called at time specified by Start
             MakeCallback (&WsnApplication::ConnectionFailed, this));
     }
     m_cbrRateFailSafe = m_cbrRate;
+    // Source named in every record, first address of the first non loopback interface
+    Ptr<Ipv4> ipv4 = GetNode ()->GetObject<Ipv4> ();
+    if (ipv4 != 0 && ipv4->GetNInterfaces () > 1 && ipv4->GetNAddresses (1) > 0)
+    {
+        m_local = ipv4->GetAddress (1, 0).GetLocal ();
+    }
 
     // Insure no pending event
     CancelEvents ();
@@ -266,18 +277,26 @@ void WsnApplication::SendPacket ()
 
     NS_ASSERT (m_sendEvent.IsExpired ());
     //leach::LeachHeader hdr(BooleanValue(false), Vector(0.0,0.0,0.0), Vector(0.0,0.0,0.0), Ipv4Address("255.255.255.255"), Time(0));
-    leach::LeachHeader hdr;
-    Ptr<Packet> packet = Create<Packet> (m_pktSize - sizeof(hdr));
+    leach::LeachHeader hdr (m_local, m_pktCount);
+    leach::LeachReadingHeader reading (m_reading->GetValue ());
+    // Record is only its headers, it is not padded to PacketSize
+    Ptr<Packet> packet = Create<Packet> ();
     Ptr<UniformRandomVariable> m_uniformRandomVariable = CreateObject<UniformRandomVariable> ();
     int64_t temp = (m_uniformRandomVariable->GetInteger(0, m_pktDeadlineLen) + m_pktDeadlineMin) + Now ().ToInteger(Time::NS);
     
     m_pktCount++;
     hdr.SetDeadline(Time(temp));
     NS_LOG_INFO(temp << ", " << hdr.GetDeadline());
+    packet->AddHeader(reading);
     packet->AddHeader(hdr);
+    // Single record aggregate, cluster heads append their queued records to it
+    leach::LeachAggregateHeader aggregate;
+    aggregate.AddRecord(packet->GetSize());
+    packet->AddHeader(aggregate);
+    packet->AddPacketTag (leach::LeachDataTag (m_local, hdr.GetSequence (), Time (temp), Simulator::Now ()));
     m_txTrace (packet);
     m_socket->Send (packet);
-    m_totBytes += m_pktSize;
+    m_totBytes += packet->GetSize ();
     if (InetSocketAddress::IsMatchingType (m_peer))
     {
         NS_LOG_INFO ("At time " << Simulator::Now ().GetSeconds ()
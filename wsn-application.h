@@ -2,6 +2,7 @@
 #define WSN_APPLICATION_H
 
 #include "ns3/address.h"
+#include "ns3/ipv4-address.h"
 #include "ns3/application.h"
 #include "ns3/event-id.h"
 #include "ns3/ptr.h"
@@ -133,6 +134,8 @@ private:
     int64_t         m_pktDeadlineLen;  //!< Packet Expired Time Len
     double          m_pktGenRate;   //!< Packet generation rate
     int             m_pktGenPattern;   //!< Packet generation distribution model
+    Ptr<RandomVariableStream>  m_reading;  //!< Sensor reading carried by each packet
+    Ipv4Address     m_local;        //!< Address named as source of the readings
   
     TracedValue<uint32_t>      m_pktCount;     //!< Total packet count
   